@@ -0,0 +1,143 @@
+/**
+ *  Belgian capacity tariff engine.
+ *
+ *  The imported energy of the running quarter hour is integrated from the power of
+ *  every telegram, so the average so far and the projected end of quarter average
+ *  are known seconds after each telegram. Both are compared with the meter's own
+ *  registers (1-0:1.4.0 and 1-0:1.6.0). Closed quarters update the peak of their
+ *  month, the last CAPACITY_MONTHS months are kept for the rolling 12 month average
+ *  the capacity tariff is billed on.
+ */
+
+// Longer gaps between two telegrams are not integrated
+#define CAPACITY_MAX_GAP 60
+
+void setupCapacity()
+{
+    capacityPowerIndex = findReadout("actual_consumption");
+    capacityMeterAverageIndex = findReadout("current_average_demand");
+    capacityMeterPeakIndex = findReadout("maximum_demand_month");
+    capacityQuarter.start = 0;
+}
+
+struct CapacityMonth &capacityMonth(long month)
+{
+    struct CapacityMonth &entry = capacityMonths[month % CAPACITY_MONTHS];
+    if (entry.month != month)
+    {
+        entry.month = month;
+        entry.peak = 0;
+        entry.peakStart = 0;
+    }
+    return entry;
+}
+
+/**
+ *  Updates the peak of the month with a quarter that just ended. A quarter that was not
+ *  followed from start to end (the first one after a boot, a gap in the telegrams) has
+ *  no known average and is skipped, the meter's own peak covers it.
+ */
+void capacityCloseQuarter()
+{
+    if (capacityQuarter.covered < CAPACITY_QUARTER)
+        return;
+
+    long average = capacityQuarter.energy / CAPACITY_QUARTER;
+    struct CapacityMonth &month = capacityMonth(epochMonth(capacityQuarter.start));
+    if (average > month.peak)
+    {
+        month.peak = average;
+        month.peakStart = capacityQuarter.start;
+    }
+}
+
+/**
+ *  Average of the monthly peaks of the last 12 months including the running one,
+ *  each at least CAPACITY_MINIMUM_PEAK.
+ */
+long capacityRollingAverage(long currentMonth)
+{
+    long sum = 0;
+    int months = 0;
+    for (int i = 0; i < CAPACITY_MONTHS; i++)
+    {
+        if (capacityMonths[i].month > currentMonth - 12 && capacityMonths[i].month <= currentMonth)
+        {
+            sum += capacityMonths[i].peak > CAPACITY_MINIMUM_PEAK ? capacityMonths[i].peak : CAPACITY_MINIMUM_PEAK;
+            months++;
+        }
+    }
+    return months ? sum / months : 0;
+}
+
+/**
+ *  Integrates the current telegram and publishes the forecast, call after each committed telegram.
+ */
+void capacityUpdate()
+{
+    if (capacityPowerIndex < 0 || meterTimestamp == 0)
+        return;
+
+    unsigned long now = meterTimestamp;
+    unsigned long start = now - now % CAPACITY_QUARTER;
+    long power = telegramObjects[capacityPowerIndex].value;
+
+    if (capacityQuarter.start != 0 && now > capacityQuarter.lastTimestamp && now - capacityQuarter.lastTimestamp <= CAPACITY_MAX_GAP)
+    {
+        // The previous power applies until this telegram, the part after a quarter
+        // boundary goes to the new quarter below
+        unsigned long until = start != capacityQuarter.start ? start : now;
+        capacityQuarter.energy += (long long)capacityQuarter.lastPower * (until - capacityQuarter.lastTimestamp);
+        capacityQuarter.covered += until - capacityQuarter.lastTimestamp;
+    }
+
+    if (start != capacityQuarter.start)
+    {
+        if (capacityQuarter.start != 0)
+            capacityCloseQuarter();
+
+        bool continuous = capacityQuarter.start != 0 && now - capacityQuarter.lastTimestamp <= CAPACITY_MAX_GAP;
+        capacityQuarter.start = start;
+        capacityQuarter.energy = continuous ? (long long)capacityQuarter.lastPower * (now - start) : 0;
+        capacityQuarter.covered = continuous ? now - start : 0;
+    }
+    capacityQuarter.lastTimestamp = now;
+    capacityQuarter.lastPower = power;
+
+    // Before the first complete telegram pair of a quarter the elapsed part is unknown,
+    // assume the current power for it
+    unsigned long elapsed = now - start;
+    long long energy = capacityQuarter.energy + (long long)power * (elapsed - capacityQuarter.covered);
+    long average = elapsed ? energy / elapsed : power;
+    long projected = (energy + (long long)power * (CAPACITY_QUARTER - elapsed)) / CAPACITY_QUARTER;
+
+    long month = epochMonth(now);
+    struct CapacityMonth &monthEntry = capacityMonth(month);
+
+    // The meter keeps counting across our reboots, trust its monthly peak when it is higher.
+    // Its timestamp falls in the quarter of the peak, 0 (unknown) when the meter has none.
+    long meterPeak = capacityMeterPeakIndex >= 0 ? telegramObjects[capacityMeterPeakIndex].value : 0;
+    if (meterPeak > monthEntry.peak)
+    {
+        monthEntry.peak = meterPeak;
+        monthEntry.peakStart = meterPeakTimestamp - meterPeakTimestamp % CAPACITY_QUARTER;
+    }
+
+    if (!mqttClient.connected())
+        return;
+
+    char payload[320];
+    int length = snprintf(payload, sizeof(payload),
+                          "{\"quarter_start\":%lu,\"elapsed\":%lu,\"average_w\":%ld,\"projected_w\":%ld,\"month_peak_w\":%ld,\"month_peak_start\":%lu,\"rolling_peak_w\":%ld",
+                          start, elapsed, average, projected, monthEntry.peak, monthEntry.peakStart, capacityRollingAverage(month));
+    if (capacityMeterAverageIndex >= 0 && length < (int)sizeof(payload))
+    {
+        long meterAverage = telegramObjects[capacityMeterAverageIndex].value;
+        length += snprintf(payload + length, sizeof(payload) - length, ",\"meter_average_w\":%ld,\"deviation_w\":%ld",
+                           meterAverage, average - meterAverage);
+    }
+    if (length < (int)sizeof(payload))
+        snprintf(payload + length, sizeof(payload) - length, "}");
+
+    mqttClient.publish(MQTT_CAPACITY_TOPIC, payload, false);
+}
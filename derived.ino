@@ -0,0 +1,69 @@
+/**
+ *  Derived metrics.
+ *
+ *  Computed once per complete telegram from values of that same telegram and
+ *  stored as normal readouts, so they are published, buffered and kept in the
+ *  history like any readout read from the meter.
+ */
+
+void setupDerivedMetrics()
+{
+    derivedReadouts.consumption = findReadout("actual_consumption");
+    derivedReadouts.received = findReadout("actual_received");
+    derivedReadouts.netPower = findReadout("net_power");
+    derivedReadouts.imbalanceCurrent = findReadout("phase_imbalance_current");
+    derivedReadouts.imbalancePower = findReadout("phase_imbalance_power");
+    for (int phase = 0; phase < 3; phase++)
+    {
+        char name[32];
+        sprintf(name, "instant_power_usage_l%d", phase + 1);
+        derivedReadouts.powerUsage[phase] = findReadout(name);
+        sprintf(name, "instant_power_return_l%d", phase + 1);
+        derivedReadouts.powerReturn[phase] = findReadout(name);
+        sprintf(name, "instant_power_current_l%d", phase + 1);
+        derivedReadouts.current[phase] = findReadout(name);
+        sprintf(name, "net_power_l%d", phase + 1);
+        derivedReadouts.netPhasePower[phase] = findReadout(name);
+    }
+}
+
+long derivedValue(int index)
+{
+    return index >= 0 ? telegramObjects[index].value : 0;
+}
+
+void setDerivedValue(int index, long value)
+{
+    if (index < 0)
+        return;
+
+    if (value != telegramObjects[index].value)
+        readoutPut(telegramObjects[index], value);
+}
+
+/**
+ *  Called from decodeTelegram() when the CRC of a telegram is valid.
+ */
+void computeDerivedMetrics()
+{
+    setDerivedValue(derivedReadouts.netPower, derivedValue(derivedReadouts.consumption) - derivedValue(derivedReadouts.received));
+
+    long minCurrent = 0, maxCurrent = 0, minPower = 0, maxPower = 0;
+    for (int phase = 0; phase < 3; phase++)
+    {
+        long power = derivedValue(derivedReadouts.powerUsage[phase]) - derivedValue(derivedReadouts.powerReturn[phase]);
+        long current = derivedValue(derivedReadouts.current[phase]);
+        setDerivedValue(derivedReadouts.netPhasePower[phase], power);
+
+        if (phase == 0 || power < minPower)
+            minPower = power;
+        if (phase == 0 || power > maxPower)
+            maxPower = power;
+        if (phase == 0 || current < minCurrent)
+            minCurrent = current;
+        if (phase == 0 || current > maxCurrent)
+            maxCurrent = current;
+    }
+    setDerivedValue(derivedReadouts.imbalanceCurrent, maxCurrent - minCurrent);
+    setDerivedValue(derivedReadouts.imbalancePower, maxPower - minPower);
+}
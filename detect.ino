@@ -0,0 +1,166 @@
+/**
+ *  Detection of the P1 serial settings.
+ *
+ *  Every candidate in p1SerialConfigs is tried in turn for its detectTime. A candidate
+ *  is accepted when a telegram header comes through cleanly: '/', the three letter
+ *  manufacturer id and the baud rate digit, followed by printable text up to the closing
+ *  '!'. At the wrong baud rate or framing the bytes come in as noise, which breaks that
+ *  pattern long before a '!' shows up. Detection therefore takes at most the sum of
+ *  all detectTimes and normally a single telegram.
+ *
+ *  Detection is a state machine in the port that readP1Serial() advances with whatever
+ *  was received, so loop() keeps serving MQTT, Modbus, the grid limits and the other
+ *  port while it runs, and boot does not wait for it.
+ *
+ *  The result is stored in NVS. Later boots start on it without detecting, a new
+ *  detection only starts when a port keeps failing (see p1NeedsDetection()).
+ */
+
+/**
+ *  Starts a port on its stored serial settings, or detects them when none are stored.
+ */
+void setupP1SerialConfig(struct P1Port &port, int index)
+{
+    char key[16];
+    snprintf(key, sizeof(key), "%s%d", P1_CONFIG_KEY, index);
+
+    Preferences preferences;
+    preferences.begin(READOUT_TABLE_NAMESPACE, true);
+    int stored = preferences.isKey(key) ? preferences.getUChar(key) : -1;
+    preferences.end();
+
+    port.crcFailures = 0;
+    port.lastValidMillis = millis();
+    if (stored >= 0 && stored < P1_SERIAL_CONFIGS)
+    {
+        port.config = stored;
+        p1PortBegin(port);
+        LOG_INFO("P1 port %s: %lu baud from NVS", port.topic, p1SerialConfigs[port.config].baud);
+        return;
+    }
+
+    port.config = 0;
+    p1StartDetection(port);
+}
+
+/**
+ *  Switches the port to the next candidate and starts listening on it.
+ */
+void p1DetectBegin(struct P1Port &port)
+{
+    port.config = (port.detectFirst + port.detectTried) % P1_SERIAL_CONFIGS;
+    p1PortBegin(port);
+    port.detectPattern = 0;
+    port.detectSince = millis();
+}
+
+/**
+ *  Starts a detection, trying every candidate starting with the current one. The port
+ *  is then advanced by p1DetectStep() from readP1Serial().
+ */
+void p1StartDetection(struct P1Port &port)
+{
+    port.detecting = true;
+    port.detectFirst = port.config;
+    port.detectTried = 0;
+    p1DetectBegin(port);
+}
+
+/**
+ *  Feeds one received byte to the header pattern. Returns true at the '!' of a clean
+ *  telegram.
+ */
+bool p1DetectByte(struct P1Port &port, int c)
+{
+    int &state = port.detectPattern; // 0 waiting for '/', 1-3 manufacturer id, 4 baud rate digit, 5 waiting for '!'
+
+    if (c == '/')
+        state = 1;
+    else if (state == 0)
+        return false;
+    else if (c != '\r' && c != '\n' && (c < 0x20 || c > 0x7e))
+        state = 0; // noise
+    else if (state <= 3)
+        state = isalpha(c) ? state + 1 : 0;
+    else if (state == 4)
+        state = isdigit(c) ? 5 : 0;
+    else if (c == '!')
+        return true;
+    return false;
+}
+
+/**
+ *  Ends the detection. Stores the candidate that worked, or goes back to the settings
+ *  the detection started from when none did (no meter connected).
+ */
+void p1DetectDone(struct P1Port &port, bool found)
+{
+    port.detecting = false;
+    if (found)
+    {
+        char key[16];
+        snprintf(key, sizeof(key), "%s%d", P1_CONFIG_KEY, (int)(&port - p1Ports));
+
+        Preferences preferences;
+        preferences.begin(READOUT_TABLE_NAMESPACE, false);
+        if (!preferences.isKey(key) || preferences.getUChar(key) != port.config)
+            preferences.putUChar(key, port.config);
+        preferences.end();
+        LOG_INFO("P1 port %s: detected %lu baud", port.topic, p1SerialConfigs[port.config].baud);
+    }
+    else
+    {
+        if (port.config != port.detectFirst)
+        {
+            port.config = port.detectFirst;
+            p1PortBegin(port);
+        }
+        LOG_WARN("P1 port %s: no telegrams found, keeping %lu baud", port.topic, p1SerialConfigs[port.config].baud);
+    }
+
+    // The parser starts at the next '/', the next detection waits for another run of failures
+    port.rxPosition = 0;
+    port.rxLength = 0;
+    port.crcFailures = 0;
+    port.lastValidMillis = millis();
+}
+
+/**
+ *  Advances a running detection with what the UART received so far, called from
+ *  readP1Serial() instead of the parser. Never waits: a candidate gets its detectTime
+ *  over as many loop() passes as it takes.
+ */
+void p1DetectStep(struct P1Port &port)
+{
+    int available = port.serial->available();
+    if (available > 0)
+    {
+        int length = port.serial->read(port.rx, available < P1_READ_CHUNK ? available : P1_READ_CHUNK);
+        for (int i = 0; i < length; i++)
+        {
+            if (p1DetectByte(port, port.rx[i]))
+            {
+                p1DetectDone(port, true);
+                return;
+            }
+        }
+    }
+
+    if (millis() - port.detectSince < p1SerialConfigs[port.config].detectTime)
+        return;
+
+    if (++port.detectTried < P1_SERIAL_CONFIGS)
+        p1DetectBegin(port);
+    else
+        p1DetectDone(port, false);
+}
+
+/**
+ *  True when the port keeps failing on its current settings: P1_DETECT_CRC_FAILURES
+ *  invalid telegrams in a row, or P1_DETECT_SILENCE milliseconds of data without a
+ *  valid telegram. Only call it when data is available.
+ */
+bool p1NeedsDetection(struct P1Port &port)
+{
+    return port.crcFailures >= P1_DETECT_CRC_FAILURES || millis() - port.lastValidMillis > P1_DETECT_SILENCE;
+}
@@ -0,0 +1,177 @@
+/**
+ *  Emulation of the HomeWizard P1 meter and Shelly 3EM HTTP APIs.
+ *
+ *  Both are polled several times per second by batteries and EMS controllers, so
+ *  all responses are serialized once per committed telegram and a request only sends
+ *  an existing buffer. Per phase power is usage minus return (1-0:21.7.0 - 1-0:22.7.0
+ *  etc.), negative when returning to the grid.
+ */
+
+void setupEmulationApi()
+{
+    emulationReadouts.importTarif1 = findReadout("consumption_tarif_1");
+    emulationReadouts.importTarif2 = findReadout("consumption_tarif_2");
+    emulationReadouts.exportTarif1 = findReadout("received_tarif_1");
+    emulationReadouts.exportTarif2 = findReadout("received_tarif_2");
+    emulationReadouts.power = findReadout("actual_consumption");
+    emulationReadouts.powerReturned = findReadout("actual_received");
+    emulationReadouts.tarif = findReadout("actual_tarif_group");
+    emulationReadouts.gas = findReadout("gas_meter_m3");
+    for (int phase = 0; phase < 3; phase++)
+    {
+        char name[32];
+        sprintf(name, "instant_power_usage_l%d", phase + 1);
+        emulationReadouts.powerUsage[phase] = findReadout(name);
+        sprintf(name, "instant_power_return_l%d", phase + 1);
+        emulationReadouts.powerReturn[phase] = findReadout(name);
+        sprintf(name, "instant_voltage_l%d", phase + 1);
+        emulationReadouts.voltage[phase] = findReadout(name);
+        sprintf(name, "instant_power_current_l%d", phase + 1);
+        emulationReadouts.current[phase] = findReadout(name);
+    }
+
+    String mac = WiFi.macAddress();
+    snprintf(homeWizardInfo, sizeof(homeWizardInfo),
+             "{\"product_type\":\"HWE-P1\",\"product_name\":\"P1 meter\",\"serial\":\"%s\",\"firmware_version\":\"%s\",\"api_version\":\"v1\"}",
+             mac.c_str(), EMULATION_FIRMWARE_VERSION);
+
+    emulationUpdate();
+
+    httpServer.on("/api", HTTP_GET, []() {
+        httpServer.send_P(200, "application/json", homeWizardInfo, strlen(homeWizardInfo));
+    });
+    httpServer.on("/api/v1/data", HTTP_GET, []() {
+        httpServer.send_P(200, "application/json", homeWizardData, homeWizardDataLength);
+    });
+    httpServer.on("/status", HTTP_GET, []() {
+        httpServer.send_P(200, "application/json", shellyStatus, shellyStatusLength);
+    });
+    for (int phase = 0; phase < 3; phase++)
+    {
+        static const char *paths[] = {"/emeter/0", "/emeter/1", "/emeter/2"};
+        httpServer.on(paths[phase], HTTP_GET, [phase]() {
+            httpServer.send_P(200, "application/json", shellyEmeter[phase], shellyEmeterLength[phase]);
+        });
+    }
+}
+
+long emulationValue(const struct TelegramSnapshot &snapshot, int index)
+{
+    return index >= 0 ? snapshot.values[index] : 0;
+}
+
+/**
+ *  Appends "key":value, with value in thousandths printed as a decimal number
+ */
+int jsonMilli(char *buffer, int length, int size, const char *key, long value)
+{
+    if (length >= size)
+        return length;
+    length += snprintf(buffer + length, size - length, "\"%s\":", key);
+    if (length >= size)
+        return length;
+    length += printMilli(buffer + length, size - length, value);
+    if (length < size)
+        buffer[length++] = ',';
+    return length;
+}
+
+/**
+ *  Appends "key":value, for a whole number
+ */
+int jsonLong(char *buffer, int length, int size, const char *key, long value)
+{
+    if (length >= size)
+        return length;
+    return length + snprintf(buffer + length, size - length, "\"%s\":%ld,", key, value);
+}
+
+/**
+ *  Replaces the trailing comma by the closing brace
+ */
+int jsonClose(char *buffer, int length, int size)
+{
+    if (length >= size)
+        return size - 1;
+    if (length > 0 && buffer[length - 1] == ',')
+        length--;
+    buffer[length++] = '}';
+    buffer[length] = 0;
+    return length;
+}
+
+void emulationUpdateHomeWizard(const struct TelegramSnapshot &snapshot)
+{
+    const int size = sizeof(homeWizardData) - 1;
+    char *buffer = homeWizardData;
+    int length = snprintf(buffer, size, "{\"smr_version\":50,\"meter_model\":\"esp32_p1meter\",");
+
+    long importTarif1 = emulationValue(snapshot, emulationReadouts.importTarif1);
+    long importTarif2 = emulationValue(snapshot, emulationReadouts.importTarif2);
+    long exportTarif1 = emulationValue(snapshot, emulationReadouts.exportTarif1);
+    long exportTarif2 = emulationValue(snapshot, emulationReadouts.exportTarif2);
+
+    // Energy readouts are in Wh, kWh with 3 decimals is the same number
+    length = jsonLong(buffer, length, size, "active_tariff", emulationValue(snapshot, emulationReadouts.tarif));
+    length = jsonMilli(buffer, length, size, "total_power_import_kwh", importTarif1 + importTarif2);
+    length = jsonMilli(buffer, length, size, "total_power_import_t1_kwh", importTarif1);
+    length = jsonMilli(buffer, length, size, "total_power_import_t2_kwh", importTarif2);
+    length = jsonMilli(buffer, length, size, "total_power_export_kwh", exportTarif1 + exportTarif2);
+    length = jsonMilli(buffer, length, size, "total_power_export_t1_kwh", exportTarif1);
+    length = jsonMilli(buffer, length, size, "total_power_export_t2_kwh", exportTarif2);
+    length = jsonLong(buffer, length, size, "active_power_w",
+                      emulationValue(snapshot, emulationReadouts.power) - emulationValue(snapshot, emulationReadouts.powerReturned));
+
+    static const char *powerKeys[] = {"active_power_l1_w", "active_power_l2_w", "active_power_l3_w"};
+    static const char *voltageKeys[] = {"active_voltage_l1_v", "active_voltage_l2_v", "active_voltage_l3_v"};
+    static const char *currentKeys[] = {"active_current_l1_a", "active_current_l2_a", "active_current_l3_a"};
+    for (int phase = 0; phase < 3; phase++)
+    {
+        length = jsonLong(buffer, length, size, powerKeys[phase],
+                          emulationValue(snapshot, emulationReadouts.powerUsage[phase]) - emulationValue(snapshot, emulationReadouts.powerReturn[phase]));
+        length = jsonMilli(buffer, length, size, voltageKeys[phase], emulationValue(snapshot, emulationReadouts.voltage[phase]));
+        length = jsonMilli(buffer, length, size, currentKeys[phase], emulationValue(snapshot, emulationReadouts.current[phase]));
+    }
+    length = jsonMilli(buffer, length, size, "total_gas_m3", emulationValue(snapshot, emulationReadouts.gas));
+    homeWizardDataLength = jsonClose(buffer, length, sizeof(homeWizardData));
+}
+
+void emulationUpdateShelly(const struct TelegramSnapshot &snapshot)
+{
+    long totalPower = 0;
+    for (int phase = 0; phase < 3; phase++)
+    {
+        long power = emulationValue(snapshot, emulationReadouts.powerUsage[phase]) - emulationValue(snapshot, emulationReadouts.powerReturn[phase]);
+        totalPower += power;
+
+        // Power is in W, voltage and current in thousandths. The meter has no per
+        // phase energy registers, so total and total_returned stay 0.
+        const int size = sizeof(shellyEmeter[phase]) - 1;
+        char *buffer = shellyEmeter[phase];
+        int length = snprintf(buffer, size, "{");
+        length = jsonMilli(buffer, length, size, "power", power * 1000);
+        length = jsonLong(buffer, length, size, "pf", 1);
+        length = jsonMilli(buffer, length, size, "current", emulationValue(snapshot, emulationReadouts.current[phase]));
+        length = jsonMilli(buffer, length, size, "voltage", emulationValue(snapshot, emulationReadouts.voltage[phase]));
+        length += snprintf(buffer + length, size - length, "\"is_valid\":true,");
+        length = jsonLong(buffer, length, size, "total", 0);
+        length = jsonLong(buffer, length, size, "total_returned", 0);
+        shellyEmeterLength[phase] = jsonClose(buffer, length, sizeof(shellyEmeter[phase]));
+    }
+
+    shellyStatusLength = snprintf(shellyStatus, sizeof(shellyStatus), "{\"emeters\":[%s,%s,%s],\"total_power\":%ld}",
+                                  shellyEmeter[0], shellyEmeter[1], shellyEmeter[2], totalPower);
+    if (shellyStatusLength >= (int)sizeof(shellyStatus))
+        shellyStatusLength = sizeof(shellyStatus) - 1;
+}
+
+/**
+ *  Serializes all emulated responses, call after each committed telegram.
+ */
+void emulationUpdate()
+{
+    struct TelegramSnapshot snapshot;
+    snapshotRead(snapshot);
+    emulationUpdateHomeWizard(snapshot);
+    emulationUpdateShelly(snapshot);
+}
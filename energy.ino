@@ -0,0 +1,87 @@
+/**
+ *  Sub-Wh energy integration.
+ *
+ *  The energy registers only step in whole Wh, the actual power arrives every
+ *  telegram in W. Between two steps of a register the power of its direction is
+ *  integrated while its tarif is active, and the integrated part is capped just
+ *  below the next Wh. Each step of the official register re-anchors the integrator,
+ *  so the estimate never drifts from the meter and never goes down.
+ */
+
+#define ENERGY_INTEGRATORS (sizeof(energyIntegrators) / sizeof(energyIntegrators[0]))
+// Longer gaps between two telegrams are not integrated
+#define ENERGY_MAX_GAP 60
+
+void setupEnergyIntegrators()
+{
+    energyTarifIndex = findReadout("actual_tarif_group");
+    for (unsigned int e = 0; e < ENERGY_INTEGRATORS; e++)
+    {
+        energyIntegrators[e].energyIndex = findReadout(energyIntegrators[e].energyReadout);
+        energyIntegrators[e].powerIndex = findReadout(energyIntegrators[e].powerReadout);
+        energyIntegrators[e].anchor = -1;
+    }
+}
+
+/**
+ *  Integrated energy in mWh, always between the register value and the next Wh.
+ */
+long energyFraction(struct EnergyIntegrator &integrator)
+{
+    // 1 mWh = 3.6 Ws
+    long long fraction = integrator.integrated * 10 / 36;
+    return fraction > 999 ? 999 : fraction;
+}
+
+/**
+ *  Call after each committed telegram.
+ */
+void energyUpdate()
+{
+    unsigned long now = meterTimestamp;
+    unsigned long elapsed = now > energyLastTimestamp && now - energyLastTimestamp <= ENERGY_MAX_GAP ? now - energyLastTimestamp : 0;
+    energyLastTimestamp = now;
+    long tarif = energyTarifIndex >= 0 ? telegramObjects[energyTarifIndex].value : 0;
+
+    for (unsigned int e = 0; e < ENERGY_INTEGRATORS; e++)
+    {
+        struct EnergyIntegrator &integrator = energyIntegrators[e];
+        if (integrator.energyIndex < 0 || integrator.powerIndex < 0)
+            continue;
+
+        long reading = telegramObjects[integrator.energyIndex].value;
+        if (reading != integrator.anchor)
+        {
+            integrator.anchor = reading;
+            integrator.integrated = 0;
+        }
+        else if (tarif == integrator.tarif)
+        {
+            // The previous power applies until this telegram
+            integrator.integrated += (long long)integrator.lastPower * elapsed;
+        }
+        integrator.lastPower = telegramObjects[integrator.powerIndex].value;
+    }
+}
+
+void energyPublish()
+{
+    long now = millis();
+    if (now - LAST_ENERGY_SENT < ENERGY_PUBLISH_INTERVAL || !mqttClient.connected())
+        return;
+    LAST_ENERGY_SENT = now;
+
+    for (unsigned int e = 0; e < ENERGY_INTEGRATORS; e++)
+    {
+        struct EnergyIntegrator &integrator = energyIntegrators[e];
+        if (integrator.energyIndex < 0 || integrator.anchor < 0)
+            continue;
+
+        char topic[sizeof(MQTT_ENERGY_TOPIC) + 32];
+        snprintf(topic, sizeof(topic), "%s/%s", MQTT_ENERGY_TOPIC, integrator.energyReadout);
+
+        char payload[24];
+        snprintf(payload, sizeof(payload), "%ld.%03ld", integrator.anchor, energyFraction(integrator));
+        sendMQTTMessage(topic, payload);
+    }
+}
@@ -1,11 +1,26 @@
 #include <ArduinoOTA.h>
+#include <LittleFS.h>
+#include <Preferences.h>
 #include <PubSubClient.h>
+#include <WebServer.h>
 #include <WiFi.h>
+#include <driver/uart.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <freertos/event_groups.h>
 
 #include "settings.h"
+#include "logger.h"
 
 WiFiClient espClient;
 PubSubClient mqttClient(espClient);
+WebServer httpServer(HTTP_PORT);
+WiFiServer modbusServer(MODBUS_PORT);
+WiFiClient modbusClients[MODBUS_MAX_CLIENTS];
+#ifdef LOG_TELNET_PORT
+WiFiServer logServer(LOG_TELNET_PORT);
+WiFiClient logClient;
+#endif
 
 /***********************************
             Main Setup
@@ -16,36 +31,31 @@ void setup()
     pinMode(LED_BUILTIN, OUTPUT);
     digitalWrite(LED_BUILTIN, LOW);
     Serial.begin(BAUD_RATE);
-    Serial2.begin(BAUD_RATE, SERIAL_8N1, RXD2, TXD2, true);
-
-#ifdef DEBUG
-    Serial.println("Booting - DEBUG mode on");
-    blinkLed(2, 500);
-    delay(500);
-    blinkLed(2, 2000);
-    // Blinking 2 times fast and two times slower to indicate DEBUG mode
-#endif
-    WiFi.mode(WIFI_STA);
-    WiFi.begin(WIFI_SSID, WIFI_PASS);
-    while (WiFi.waitForConnectResult() != WL_CONNECTED)
-    {
-#ifdef DEBUG
-        Serial.println("Connection Failed! Rebooting...");
+    setupLogger();
+    setupLoopEvents();
+    LOG_INFO("Booting");
+
+    // WiFi connects in the background while the rest is set up
+    setupWifi();
+    setupReadoutTable();
+    setupP1Ports();
+#ifdef POWER_SAVE
+    // After the ports, it arms their RX pins as wake sources
+    setupPower();
 #endif
-        delay(5000);
-        ESP.restart();
-    }
-    delay(3000);
-    setupDataReadout();
-    setupOTA();
+    setupDerivedMetrics();
+    setupGridLimits();
+    setupCapacity();
+    setupEnergyIntegrators();
+    setupOutbox();
+    setupHistory();
+    setupRollups();
+    restoreRetainedState();
 
     mqttClient.setServer(MQTT_HOST, atoi(MQTT_PORT));
-    blinkLed(5, 500); // Blink 5 times to indicate end of setup
-#ifdef DEBUG
-    Serial.println("Ready");
-    Serial.print("IP address: ");
-    Serial.println(WiFi.localIP());
-#endif
+    mqttClient.setBufferSize(MQTT_BUFFER_SIZE);
+    mqttClient.setCallback(mqttCallback);
+    LOG_INFO("Ready after %lu ms", millis());
 }
 
 /***********************************
@@ -53,66 +63,98 @@ void setup()
  ***********************************/
 void loop()
 {
+    loopWait();
+
     long now = millis();
-    if (WiFi.status() != WL_CONNECTED)
+    bool wifiConnected = wifiHandle();
+
+    if (networkStarted)
     {
-        blinkLed(20, 50); // Blink fast to indicate failed WiFi connection
-        WiFi.begin(WIFI_SSID, WIFI_PASS);
-        while (WiFi.waitForConnectResult() != WL_CONNECTED)
-        {
-#ifdef DEBUG
-            Serial.println("Connection Failed! Rebooting...");
-#endif
-            delay(5000);
-            ESP.restart();
-        }
+        ArduinoOTA.handle();
+        httpServer.handleClient();
+        modbusHandle();
     }
 
-    ArduinoOTA.handle();
-
-    if (!mqttClient.connected())
+    // Without WiFi the telegrams go to the outbox
+    if (wifiConnected && !mqttClient.connected())
     {
         if (now - LAST_RECONNECT_ATTEMPT > 5000)
         {
             LAST_RECONNECT_ATTEMPT = now;
 
-            if (!mqttReconnect())
+            if (!mqttReconnect() && MQTT_RECONNECT_RETRIES >= MQTT_MAX_RECONNECT_TRIES)
             {
-#ifdef DEBUG
-                Serial.println("Connection to MQTT Failed! Rebooting...");
-#endif
+                LOG_ERROR("Connection to MQTT Failed! Rebooting...");
+                outboxFlush();
+                logFlush();
                 delay(5000);
                 ESP.restart();
             }
-            else
-            {
-                LAST_RECONNECT_ATTEMPT = 0;
-            }
         }
     }
-    else
+    else if (mqttClient.connected())
     {
         mqttClient.loop();
+        outboxReplay();
+        publishParserStats();
+        publishSchedulerStats();
     }
+#ifdef POWER_SAVE
+    powerReport();
+#endif
 
     // Check if we want a full update of all the data including the unchanged data.
     if (now - LAST_FULL_UPDATE_SENT > UPDATE_FULL_INTERVAL)
     {
-        for (int i = 0; i < NUMBER_OF_READOUTS; i++)
+        for (int p = 0; p < P1_PORTS; p++)
         {
-            telegramObjects[i].sendData = true;
-            LAST_FULL_UPDATE_SENT = millis();
+            for (int i = 0; i < numberOfReadouts; i++)
+            {
+                p1Ports[p].objects[i].sendData = true;
+            }
+        }
+        LAST_FULL_UPDATE_SENT = millis();
+    }
+
+    // The ports are parsed on every pass. Every committed telegram is stored, only
+    // publishing waits for UPDATE_INTERVAL
+    if (readP1Serial(p1Ports[0]))
+    {
+        gridLimitPublishEvents();
+        capacityUpdate();
+        energyUpdate();
+        energyPublish();
+        historyAppendTelegram();
+        rollupUpdateTelegram();
+        modbusUpdateRegisters();
+        emulationUpdate();
+        if (!mqttClient.connected())
+            outboxPush();
+        else if (p1PublishDue(p1Ports[0]))
+        {
+            unsigned long enqueued = micros();
+            sendDataToBroker(p1Ports[0]);
+            latencyRecordTelegram(enqueued, micros());
+            latencyPublish();
+            if (firstPublishMillis == 0)
+                publishBootReport();
         }
+        // After publishing, so what was published is no longer pending after a restart
+        retainSave();
     }
 
-    if (now - LAST_UPDATE_SENT > UPDATE_INTERVAL)
+    // The other ports only publish, their values stay until the broker is back
+    for (int p = 1; p < P1_PORTS; p++)
     {
-        if (readP1Serial())
+        if (readP1Serial(p1Ports[p]))
         {
-            LAST_UPDATE_SENT = millis();
-            sendDataToBroker();
+            if (mqttClient.connected() && p1PublishDue(p1Ports[p]))
+                sendDataToBroker(p1Ports[p]);
+            retainSave();
         }
     }
+
+    logDrain();
 }
 
 /***********************************
@@ -122,13 +164,20 @@ void loop()
 /**
    setupDataReadout()
 
-   This method can be used to create more data readout to mqtt topic.
+   This method sets up the default readout table, a table stored in NVS replaces it (see readouts.ino).
+   It can be used to create more data readout to mqtt topic.
    Use the name for the mqtt topic.
    The code for finding this in the telegram see
     https://www.netbeheernederland.nl/_upload/Files/Slimme_meter_15_a727fce1f1.pdf for the dutch codes pag. 19 -23
    Use startChar and endChar for setting the boundies where the value is in between.
    Default startChar and endChar is '(' and ')'
-   Note: Make sure when you add or remove telegramObject to update the NUMBER_OF_READOUTS accordingly.
+   Set counter for cumulative registers (energy, gas), the rollups keep first/last/delta for those
+   instead of min/max/mean.
+   Set scale for values ending in '*', default 1000 (e.g. kWh to Wh).
+   Set priority and interval (minimum milliseconds between publishes) to publish live power every
+   telegram and slow moving values less often, e.g. the totals only on change and at most every 5 minutes.
+   Note: Use consecutive indices, the table ends at the first telegramObject without a name.
+   NUMBER_OF_READOUTS is the maximum.
 */
 void setupDataReadout()
 {
@@ -137,124 +186,192 @@ void setupDataReadout()
     telegramObjects[0].name = "consumption_tarif_1";
     strcpy(telegramObjects[0].code, "1-0:1.8.1");
     telegramObjects[0].endChar = '*';
+    telegramObjects[0].counter = true;
+    telegramObjects[0].priority = READOUT_PRIORITY_LOW;
+    telegramObjects[0].interval = 300000;
 
     // 1-0:1.8.2(000560.157*kWh)
     // 1-0:1.8.2 = Elektra verbruik hoog tarief (DSMR v5.0)
     telegramObjects[1].name = "consumption_tarif_2";
     strcpy(telegramObjects[1].code, "1-0:1.8.2");
     telegramObjects[1].endChar = '*';
-
-    telegramObjects[0].name = "received_tarif_1";
-    strcpy(telegramObjects[0].code, "1-0:2.8.1");
-    telegramObjects[0].endChar = '*';
-
-    // 1-0:1.8.2(000560.157*kWh)
-    // 1-0:1.8.2 = Elektra verbruik hoog tarief (DSMR v5.0)
-    telegramObjects[1].name = "received_tarif_2";
-    strcpy(telegramObjects[1].code, "1-0:2.8.2");
-    telegramObjects[1].endChar = '*';
+    telegramObjects[1].counter = true;
+    telegramObjects[1].priority = READOUT_PRIORITY_LOW;
+    telegramObjects[1].interval = 300000;
+
+    // 1-0:2.8.1(000535.014*kWh)
+    // 1-0:2.8.1 = Elektra teruglevering laag tarief (DSMR v5.0)
+    telegramObjects[2].name = "received_tarif_1";
+    strcpy(telegramObjects[2].code, "1-0:2.8.1");
+    telegramObjects[2].endChar = '*';
+    telegramObjects[2].counter = true;
+    telegramObjects[2].priority = READOUT_PRIORITY_LOW;
+    telegramObjects[2].interval = 300000;
+
+    // 1-0:2.8.2(000175.049*kWh)
+    // 1-0:2.8.2 = Elektra teruglevering hoog tarief (DSMR v5.0)
+    telegramObjects[3].name = "received_tarif_2";
+    strcpy(telegramObjects[3].code, "1-0:2.8.2");
+    telegramObjects[3].endChar = '*';
+    telegramObjects[3].counter = true;
+    telegramObjects[3].priority = READOUT_PRIORITY_LOW;
+    telegramObjects[3].interval = 300000;
 
     // 1-0:1.7.0(00.424*kW) Actueel verbruik
     // 1-0:1.7.x = Electricity consumption actual usage (DSMR v5.0)
-    telegramObjects[2].name = "actual_consumption";
-    strcpy(telegramObjects[2].code, "1-0:1.7.0");
-    telegramObjects[2].endChar = '*';
+    telegramObjects[4].name = "actual_consumption";
+    strcpy(telegramObjects[4].code, "1-0:1.7.0");
+    telegramObjects[4].endChar = '*';
+    telegramObjects[4].priority = READOUT_PRIORITY_HIGH;
 
     // 1-0:2.7.0(00.000*kW) Actuele teruglevering (-P) in 1 Watt resolution
-    telegramObjects[3].name = "actual_received";
-    strcpy(telegramObjects[3].code, "1-0:2.7.0");
-    telegramObjects[3].endChar = '*';
+    telegramObjects[5].name = "actual_received";
+    strcpy(telegramObjects[5].code, "1-0:2.7.0");
+    telegramObjects[5].endChar = '*';
+    telegramObjects[5].priority = READOUT_PRIORITY_HIGH;
 
     // 1-0:21.7.0(00.378*kW)
     // 1-0:21.7.0 = Instantaan vermogen Elektriciteit levering L1
-    telegramObjects[4].name = "instant_power_usage_l1";
-    strcpy(telegramObjects[4].code, "1-0:21.7.0");
-    telegramObjects[4].endChar = '*';
+    telegramObjects[6].name = "instant_power_usage_l1";
+    strcpy(telegramObjects[6].code, "1-0:21.7.0");
+    telegramObjects[6].endChar = '*';
+    telegramObjects[6].priority = READOUT_PRIORITY_HIGH;
 
     // 1-0:41.7.0(00.378*kW)
     // 1-0:41.7.0 = Instantaan vermogen Elektriciteit levering L2
-    telegramObjects[5].name = "instant_power_usage_l2";
-    strcpy(telegramObjects[5].code, "1-0:41.7.0");
-    telegramObjects[5].endChar = '*';
+    telegramObjects[7].name = "instant_power_usage_l2";
+    strcpy(telegramObjects[7].code, "1-0:41.7.0");
+    telegramObjects[7].endChar = '*';
+    telegramObjects[7].priority = READOUT_PRIORITY_HIGH;
 
     // 1-0:61.7.0(00.378*kW)
     // 1-0:61.7.0 = Instantaan vermogen Elektriciteit levering L3
-    telegramObjects[6].name = "instant_power_usage_l3";
-    strcpy(telegramObjects[6].code, "1-0:61.7.0");
-    telegramObjects[6].endChar = '*';
+    telegramObjects[8].name = "instant_power_usage_l3";
+    strcpy(telegramObjects[8].code, "1-0:61.7.0");
+    telegramObjects[8].endChar = '*';
+    telegramObjects[8].priority = READOUT_PRIORITY_HIGH;
 
     // 1-0:22.7.0(00.378*kW)
     // 1-0:22.7.0 = Instantaan vermogen Elektriciteit teruglevering L1
-    telegramObjects[4].name = "instant_power_return_l1";
-    strcpy(telegramObjects[4].code, "1-0:22.7.0");
-    telegramObjects[4].endChar = '*';
+    telegramObjects[9].name = "instant_power_return_l1";
+    strcpy(telegramObjects[9].code, "1-0:22.7.0");
+    telegramObjects[9].endChar = '*';
+    telegramObjects[9].priority = READOUT_PRIORITY_HIGH;
 
     // 1-0:42.7.0(00.378*kW)
     // 1-0:42.7.0 = Instantaan vermogen Elektriciteit teruglevering L2
-    telegramObjects[5].name = "instant_power_return_l2";
-    strcpy(telegramObjects[5].code, "1-0:42.7.0");
-    telegramObjects[5].endChar = '*';
+    telegramObjects[10].name = "instant_power_return_l2";
+    strcpy(telegramObjects[10].code, "1-0:42.7.0");
+    telegramObjects[10].endChar = '*';
+    telegramObjects[10].priority = READOUT_PRIORITY_HIGH;
 
     // 1-0:62.7.0(00.378*kW)
     // 1-0:62.7.0 = Instantaan vermogen Elektriciteit teruglevering L3
-    telegramObjects[6].name = "instant_power_return_l3";
-    strcpy(telegramObjects[6].code, "1-0:62.7.0");
-    telegramObjects[6].endChar = '*';
+    telegramObjects[11].name = "instant_power_return_l3";
+    strcpy(telegramObjects[11].code, "1-0:62.7.0");
+    telegramObjects[11].endChar = '*';
+    telegramObjects[11].priority = READOUT_PRIORITY_HIGH;
 
     // 1-0:31.7.0(002*A)
     // 1-0:31.7.0 = Instantane stroom Elektriciteit L1
-    telegramObjects[7].name = "instant_power_current_l1";
-    strcpy(telegramObjects[7].code, "1-0:31.7.0");
-    telegramObjects[7].endChar = '*';
+    telegramObjects[12].name = "instant_power_current_l1";
+    strcpy(telegramObjects[12].code, "1-0:31.7.0");
+    telegramObjects[12].endChar = '*';
+    telegramObjects[12].interval = 10000;
 
     // 1-0:51.7.0(002*A)
     // 1-0:51.7.0 = Instantane stroom Elektriciteit L2
-    telegramObjects[8].name = "instant_power_current_l2";
-    strcpy(telegramObjects[8].code, "1-0:51.7.0");
-    telegramObjects[8].endChar = '*';
+    telegramObjects[13].name = "instant_power_current_l2";
+    strcpy(telegramObjects[13].code, "1-0:51.7.0");
+    telegramObjects[13].endChar = '*';
+    telegramObjects[13].interval = 10000;
 
     // 1-0:71.7.0(002*A)
     // 1-0:71.7.0 = Instantane stroom Elektriciteit L3
-    telegramObjects[9].name = "instant_power_current_l3";
-    strcpy(telegramObjects[9].code, "1-0:71.7.0");
-    telegramObjects[9].endChar = '*';
+    telegramObjects[14].name = "instant_power_current_l3";
+    strcpy(telegramObjects[14].code, "1-0:71.7.0");
+    telegramObjects[14].endChar = '*';
+    telegramObjects[14].interval = 10000;
 
     // 1-0:32.7.0(232.0*V)
     // 1-0:32.7.0 = Voltage L1
-    telegramObjects[10].name = "instant_voltage_l1";
-    strcpy(telegramObjects[10].code, "1-0:32.7.0");
-    telegramObjects[10].endChar = '*';
+    telegramObjects[15].name = "instant_voltage_l1";
+    strcpy(telegramObjects[15].code, "1-0:32.7.0");
+    telegramObjects[15].endChar = '*';
+    telegramObjects[15].interval = 10000;
 
     // 1-0:52.7.0(232.0*V)
     // 1-0:52.7.0 = Voltage L2
-    telegramObjects[11].name = "instant_voltage_l2";
-    strcpy(telegramObjects[11].code, "1-0:52.7.0");
-    telegramObjects[11].endChar = '*';
+    telegramObjects[16].name = "instant_voltage_l2";
+    strcpy(telegramObjects[16].code, "1-0:52.7.0");
+    telegramObjects[16].endChar = '*';
+    telegramObjects[16].interval = 10000;
 
     // 1-0:72.7.0(232.0*V)
     // 1-0:72.7.0 = Voltage L3
-    telegramObjects[12].name = "instant_voltage_l3";
-    strcpy(telegramObjects[12].code, "1-0:72.7.0");
-    telegramObjects[12].endChar = '*';
+    telegramObjects[17].name = "instant_voltage_l3";
+    strcpy(telegramObjects[17].code, "1-0:72.7.0");
+    telegramObjects[17].endChar = '*';
+    telegramObjects[17].interval = 10000;
 
     // 0-0:96.14.0(0001)
     // 0-0:96.14.0 = Actual Tarif
-    telegramObjects[13].name = "actual_tarif_group";
-    strcpy(telegramObjects[13].code, "0-0:96.14.0");
+    telegramObjects[18].name = "actual_tarif_group";
+    strcpy(telegramObjects[18].code, "0-0:96.14.0");
 
     // 0-1:24.2.3(150531200000S)(00811.923*m3)
     // 0-1:24.2.3 = Gas (DSMR v5.0) on Belgian meters
-    telegramObjects[18].name = "gas_meter_m3";
-    strcpy(telegramObjects[18].code, "0-1:24.2.3");
-    telegramObjects[12].endChar = '*';
+    telegramObjects[19].name = "gas_meter_m3";
+    strcpy(telegramObjects[19].code, "0-1:24.2.3");
+    telegramObjects[19].endChar = '*';
+    telegramObjects[19].counter = true;
+    telegramObjects[19].priority = READOUT_PRIORITY_LOW;
+    telegramObjects[19].interval = 300000;
+
+    // 1-0:1.4.0(02.351*kW)
+    // 1-0:1.4.0 = Current average demand, running quarter hour (Fluvius)
+    telegramObjects[20].name = "current_average_demand";
+    strcpy(telegramObjects[20].code, "1-0:1.4.0");
+    telegramObjects[20].endChar = '*';
+    telegramObjects[20].interval = 10000;
+
+    // 1-0:1.6.0(200509134558S)(02.589*kW)
+    // 1-0:1.6.0 = Maximum demand of the running month (Fluvius)
+    telegramObjects[21].name = "maximum_demand_month";
+    strcpy(telegramObjects[21].code, "1-0:1.6.0");
+    telegramObjects[21].endChar = '*';
+    telegramObjects[21].priority = READOUT_PRIORITY_LOW;
+
+    // Derived readouts have no code, they are computed by computeDerivedMetrics()
+    // from the readouts above once a telegram is complete.
+    // Net grid power in W, actual_consumption - actual_received (negative when returning)
+    telegramObjects[22].name = "net_power";
+    telegramObjects[22].priority = READOUT_PRIORITY_HIGH;
+
+    // Net power per phase in W, instant_power_usage_lx - instant_power_return_lx
+    telegramObjects[23].name = "net_power_l1";
+    telegramObjects[23].priority = READOUT_PRIORITY_HIGH;
+    telegramObjects[24].name = "net_power_l2";
+    telegramObjects[24].priority = READOUT_PRIORITY_HIGH;
+    telegramObjects[25].name = "net_power_l3";
+    telegramObjects[25].priority = READOUT_PRIORITY_HIGH;
+
+    // Phase imbalance, highest minus lowest phase current (mA) and net phase power (W)
+    telegramObjects[26].name = "phase_imbalance_current";
+    telegramObjects[26].interval = 10000;
+    telegramObjects[27].name = "phase_imbalance_power";
+    telegramObjects[27].interval = 10000;
+}
 
-#ifdef DEBUG
-    Serial.println("MQTT Topics initialized:");
-    for (int i = 0; i < NUMBER_OF_READOUTS; i++)
-    {
-        Serial.println(String(MQTT_ROOT_TOPIC) + "/" + telegramObjects[i].name);
-    }
-#endif
+/**
+   HTTP server setup, every API registers its own routes
+*/
+void setupHttpServer()
+{
+    setupReadoutTableApi();
+    setupHistoryApi();
+    setupEmulationApi();
+    httpServer.begin();
 }
 
 /**
@@ -0,0 +1,59 @@
+/**
+ *  Event driven loop().
+ *
+ *  loop() sleeps in loopWait() until something needs it: data on a P1 port (the UART
+ *  driver's receive callback), a WiFi state change, or at the latest after
+ *  LOOP_IDLE_WAIT milliseconds for the services that can only be polled (MQTT,
+ *  HTTP, Modbus, OTA) and the periodic publishers. While loop() waits, the FreeRTOS
+ *  idle task lets the core sleep instead of spinning.
+ */
+
+void loopWakeP1()
+{
+    xEventGroupSetBits(loopEvents, LOOP_EVENT_P1);
+}
+
+void loopWakeWifi(WiFiEvent_t event)
+{
+    xEventGroupSetBits(loopEvents, LOOP_EVENT_WIFI);
+}
+
+void setupLoopEvents()
+{
+    loopEvents = xEventGroupCreate();
+    WiFi.onEvent(loopWakeWifi);
+}
+
+/**
+ *  True when received bytes are still waiting for the parser, e.g. the next telegram
+ *  after one that was just committed.
+ */
+bool loopHasP1Data()
+{
+    for (int p = 0; p < P1_PORTS; p++)
+    {
+        if (p1Ports[p].rxPosition < p1Ports[p].rxLength || p1Ports[p].serial->available() > 0)
+            return true;
+    }
+    return false;
+}
+
+/**
+ *  Waits for the next event, returns right away when there is P1 data left to parse.
+ */
+void loopWait()
+{
+#ifdef POWER_SAVE
+    powerUpdate();
+#endif
+    if (loopHasP1Data())
+        return;
+
+#ifdef POWER_SAVE
+    unsigned long start = micros();
+#endif
+    xEventGroupWaitBits(loopEvents, LOOP_EVENTS, pdTRUE, pdFALSE, pdMS_TO_TICKS(LOOP_IDLE_WAIT));
+#ifdef POWER_SAVE
+    powerWaited(micros() - start);
+#endif
+}
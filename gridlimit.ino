@@ -0,0 +1,114 @@
+/**
+ *  Grid limit triggers.
+ *
+ *  The rules are evaluated from decodeTelegram() as soon as the CRC of a telegram
+ *  checks out, so a GPIO reacts within the telegram period it was measured in. The
+ *  retained MQTT event is published from the main loop right after.
+ *  Rules may share a pin, the pin is high while any of its rules is active.
+ */
+
+#define GRID_LIMIT_RULES (sizeof(gridLimitRules) / sizeof(gridLimitRules[0]))
+
+void setupGridLimits()
+{
+    for (unsigned int r = 0; r < GRID_LIMIT_RULES; r++)
+    {
+        gridLimitRules[r].readoutIndex = findReadout(gridLimitRules[r].readout);
+        if (gridLimitRules[r].pin >= 0)
+        {
+            pinMode(gridLimitRules[r].pin, OUTPUT);
+            digitalWrite(gridLimitRules[r].pin, LOW);
+        }
+        if (gridLimitRules[r].readoutIndex < 0)
+            LOG_WARN("Grid limit %s: unknown readout %s", gridLimitRules[r].name, gridLimitRules[r].readout);
+    }
+}
+
+void gridLimitEvaluate()
+{
+    unsigned long now = millis();
+    bool changed = false;
+
+    for (unsigned int r = 0; r < GRID_LIMIT_RULES; r++)
+    {
+        struct GridLimitRule &rule = gridLimitRules[r];
+        if (rule.readoutIndex < 0)
+            continue;
+
+        long value = telegramObjects[rule.readoutIndex].value;
+        bool crossed = rule.active ? value <= rule.off : value >= rule.on;
+        if (!crossed)
+        {
+            rule.pending = false;
+            continue;
+        }
+
+        if (!rule.pending)
+        {
+            rule.pending = true;
+            rule.pendingSince = now;
+        }
+
+        if (now - rule.pendingSince >= rule.holdTime)
+        {
+            rule.active = !rule.active;
+            rule.pending = false;
+            rule.publish = true;
+            changed = true;
+        }
+    }
+
+    if (!changed)
+        return;
+
+    for (unsigned int r = 0; r < GRID_LIMIT_RULES; r++)
+    {
+        if (gridLimitRules[r].pin < 0)
+            continue;
+
+        bool high = false;
+        for (unsigned int other = 0; other < GRID_LIMIT_RULES; other++)
+        {
+            high |= gridLimitRules[other].pin == gridLimitRules[r].pin && gridLimitRules[other].active;
+        }
+        digitalWrite(gridLimitRules[r].pin, high ? HIGH : LOW);
+    }
+
+    unsigned long switched = micros();
+    for (unsigned int r = 0; r < GRID_LIMIT_RULES; r++)
+    {
+        if (gridLimitRules[r].publish)
+        {
+            gridLimitRules[r].latencyMicros = switched - telegramEndMicros;
+            gridLimitRules[r].ageMicros = switched - telegramStartMicros;
+        }
+    }
+}
+
+/**
+ *  Publishes the changed rules as retained messages on MQTT_GRID_LIMIT_TOPIC/<name>.
+ *  Rules stay marked while the broker is unreachable.
+ */
+void gridLimitPublishEvents()
+{
+    if (!mqttClient.connected())
+        return;
+
+    for (unsigned int r = 0; r < GRID_LIMIT_RULES; r++)
+    {
+        struct GridLimitRule &rule = gridLimitRules[r];
+        if (!rule.publish)
+            continue;
+
+        char topic[sizeof(MQTT_GRID_LIMIT_TOPIC) + 32];
+        snprintf(topic, sizeof(topic), "%s/%s", MQTT_GRID_LIMIT_TOPIC, rule.name);
+
+        char payload[160];
+        snprintf(payload, sizeof(payload), "{\"active\":%s,\"value\":%ld,\"ts\":%lu,\"latency_us\":%lu,\"age_us\":%lu}",
+                 rule.active ? "true" : "false", telegramObjects[rule.readoutIndex].value, meterTimestamp,
+                 rule.latencyMicros, rule.ageMicros);
+
+        if (mqttClient.publish(topic, payload, true))
+            rule.publish = false;
+    }
+}
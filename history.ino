@@ -0,0 +1,259 @@
+/**
+ *  Compressed on-device history of every committed telegram.
+ *
+ *  Samples are stored in fixed size blocks. The first sample of a block is stored
+ *  as-is (32 bits for the timestamp and for every readout), every next sample stores
+ *  the delta-of-delta of the timestamp and of the counters, and the plain delta of the
+ *  other readouts, with a variable length prefix code:
+ *
+ *      0                    value 0           1 bit
+ *      10     +  3 bits     |value| < 4       5 bits
+ *      110    +  7 bits     |value| < 64     10 bits
+ *      1110   + 14 bits     |value| < 8192   18 bits
+ *      11110  + 20 bits                      25 bits
+ *      11111  + 32 bits                      37 bits
+ *
+ *  A steady clock and a counter that rises at a steady rate cost a single bit. Power,
+ *  voltage and current jitter around a level, a delta-of-delta would double that noise,
+ *  so they store the change since the previous sample. Appending is O(1), decoding is
+ *  a sequential scan of a block.
+ */
+
+#define HISTORY_MAX_SAMPLE_BITS (37 * (NUMBER_OF_READOUTS + 1))
+
+void setupHistory()
+{
+    historyBlockCapacity = psramFound() ? HISTORY_BLOCKS : HISTORY_BLOCKS_NO_PSRAM;
+    if (psramFound())
+        historyBlocks = (struct HistoryBlock *)ps_malloc(historyBlockCapacity * sizeof(HistoryBlock));
+    else
+        historyBlocks = (struct HistoryBlock *)malloc(historyBlockCapacity * sizeof(HistoryBlock));
+
+    if (historyBlocks == NULL)
+    {
+        historyBlockCapacity = 0;
+        LOG_ERROR("History: allocation failed, history disabled");
+        return;
+    }
+
+    LOG_INFO("History: %d blocks of %d bytes", historyBlockCapacity, HISTORY_BLOCK_SIZE);
+}
+
+struct HistoryBlock *historyBlockAt(int block)
+{
+    return &historyBlocks[(historyFirstBlock + block) % historyBlockCapacity];
+}
+
+void historyWriteBits(struct HistoryBlock *block, unsigned long value, int bits)
+{
+    while (bits > 0)
+    {
+        int freeBits = 8 - (block->bitLength & 7);
+        int n = bits < freeBits ? bits : freeBits;
+        unsigned long chunk = (value >> (bits - n)) & ((1UL << n) - 1);
+        block->data[block->bitLength >> 3] |= chunk << (freeBits - n);
+        block->bitLength += n;
+        bits -= n;
+    }
+}
+
+unsigned long historyReadBits(const struct HistoryBlock *block, unsigned long &position, int bits)
+{
+    unsigned long value = 0;
+    while (bits > 0)
+    {
+        int availableBits = 8 - (position & 7);
+        int n = bits < availableBits ? bits : availableBits;
+        unsigned long chunk = (block->data[position >> 3] >> (availableBits - n)) & ((1UL << n) - 1);
+        value = (value << n) | chunk;
+        position += n;
+        bits -= n;
+    }
+    return value;
+}
+
+void historyWriteDelta(struct HistoryBlock *block, long delta)
+{
+    // Zigzag, small negative and positive deltas both become small numbers
+    uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+
+    if (zigzag == 0)
+        historyWriteBits(block, 0x0, 1);
+    else if (zigzag < (1UL << 3))
+        historyWriteBits(block, (0x2UL << 3) | zigzag, 5);
+    else if (zigzag < (1UL << 7))
+        historyWriteBits(block, (0x6UL << 7) | zigzag, 10);
+    else if (zigzag < (1UL << 14))
+        historyWriteBits(block, (0xEUL << 14) | zigzag, 18);
+    else if (zigzag < (1UL << 20))
+        historyWriteBits(block, (0x1EUL << 20) | zigzag, 25);
+    else
+    {
+        historyWriteBits(block, 0x1F, 5);
+        historyWriteBits(block, zigzag, 32);
+    }
+}
+
+long historyReadDelta(const struct HistoryBlock *block, unsigned long &position)
+{
+    static const int payloadBits[] = {0, 3, 7, 14, 20, 32};
+
+    int ones = 0;
+    while (ones < 5 && historyReadBits(block, position, 1))
+        ones++;
+
+    uint32_t zigzag = historyReadBits(block, position, payloadBits[ones]);
+    return (int32_t)((zigzag >> 1) ^ -(int32_t)(zigzag & 1));
+}
+
+/**
+ *  Starts a new block, reusing the oldest one when all blocks are in use.
+ */
+struct HistoryBlock *historyStartBlock()
+{
+    if (historyBlocksUsed < historyBlockCapacity)
+        historyBlocksUsed++;
+    else
+        historyFirstBlock = (historyFirstBlock + 1) % historyBlockCapacity;
+
+    struct HistoryBlock *block = historyBlockAt(historyBlocksUsed - 1);
+    memset(block, 0, sizeof(HistoryBlock));
+    historyWriter.block = historyBlocksUsed - 1;
+    historyWriter.sample = 0;
+    return block;
+}
+
+/**
+ *  Appends a sample to the history, called once for every committed telegram.
+ */
+void historyAppend(unsigned long timestamp, const long values[])
+{
+    if (historyBlockCapacity == 0)
+        return;
+
+    struct HistoryBlock *block = NULL;
+    if (historyBlocksUsed > 0)
+        block = historyBlockAt(historyBlocksUsed - 1);
+    if (block == NULL || block->bitLength + HISTORY_MAX_SAMPLE_BITS > HISTORY_BLOCK_SIZE * 8UL)
+        block = historyStartBlock();
+
+    if (block->count == 0)
+    {
+        historyWriteBits(block, timestamp, 32);
+        historyWriter.timestampDelta = 0;
+        for (int i = 0; i < numberOfReadouts; i++)
+        {
+            historyWriteBits(block, (uint32_t)values[i], 32);
+            historyWriter.valueDeltas[i] = 0;
+        }
+        block->firstTimestamp = timestamp;
+    }
+    else
+    {
+        long timestampDelta = (long)(timestamp - historyWriter.timestamp);
+        historyWriteDelta(block, timestampDelta - historyWriter.timestampDelta);
+        historyWriter.timestampDelta = timestampDelta;
+        for (int i = 0; i < numberOfReadouts; i++)
+        {
+            long valueDelta = values[i] - historyWriter.values[i];
+            if (telegramObjects[i].counter)
+                historyWriteDelta(block, valueDelta - historyWriter.valueDeltas[i]);
+            else
+                historyWriteDelta(block, valueDelta);
+            historyWriter.valueDeltas[i] = valueDelta;
+        }
+    }
+
+    historyWriter.timestamp = timestamp;
+    for (int i = 0; i < numberOfReadouts; i++)
+    {
+        historyWriter.values[i] = values[i];
+    }
+    historyWriter.sample++;
+    block->lastTimestamp = timestamp;
+    block->count++;
+}
+
+/**
+ *  Appends the current telegram values, see historyAppend().
+ */
+void historyAppendTelegram()
+{
+    long values[NUMBER_OF_READOUTS];
+    for (int i = 0; i < numberOfReadouts; i++)
+    {
+        values[i] = telegramObjects[i].value;
+    }
+    historyAppend(meterTimestamp, values);
+}
+
+/**
+ *  Uses the first/last timestamp of every block as a sparse index, returns the
+ *  first block that holds samples at or after timestamp (historyBlocksUsed if none).
+ */
+int historyFindBlock(unsigned long timestamp)
+{
+    int low = 0;
+    int high = historyBlocksUsed;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (historyBlockAt(mid)->lastTimestamp < timestamp)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+/**
+ *  Positions the cursor before the first sample of a block (0 is the oldest block).
+ */
+void historySeekBlock(struct HistoryCursor &cursor, int block)
+{
+    cursor.block = block;
+    cursor.sample = 0;
+    cursor.bitPosition = 0;
+}
+
+/**
+ *  Decodes the next sample into cursor.timestamp and cursor.values,
+ *  continuing in the next block when the current one is done.
+ *  Returns false when there are no more samples.
+ */
+bool historyNext(struct HistoryCursor &cursor)
+{
+    while (cursor.block < historyBlocksUsed && cursor.sample >= historyBlockAt(cursor.block)->count)
+    {
+        historySeekBlock(cursor, cursor.block + 1);
+    }
+    if (cursor.block >= historyBlocksUsed)
+        return false;
+
+    const struct HistoryBlock *block = historyBlockAt(cursor.block);
+    if (cursor.sample == 0)
+    {
+        cursor.timestamp = historyReadBits(block, cursor.bitPosition, 32);
+        cursor.timestampDelta = 0;
+        for (int i = 0; i < numberOfReadouts; i++)
+        {
+            cursor.values[i] = (int32_t)historyReadBits(block, cursor.bitPosition, 32);
+            cursor.valueDeltas[i] = 0;
+        }
+    }
+    else
+    {
+        cursor.timestampDelta += historyReadDelta(block, cursor.bitPosition);
+        cursor.timestamp += cursor.timestampDelta;
+        for (int i = 0; i < numberOfReadouts; i++)
+        {
+            if (telegramObjects[i].counter)
+                cursor.valueDeltas[i] += historyReadDelta(block, cursor.bitPosition);
+            else
+                cursor.valueDeltas[i] = historyReadDelta(block, cursor.bitPosition);
+            cursor.values[i] += cursor.valueDeltas[i];
+        }
+    }
+    cursor.sample++;
+    return true;
+}
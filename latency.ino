@@ -0,0 +1,86 @@
+/**
+ *  End-to-end latency of the main meter's telegrams.
+ *
+ *  Every telegram is stamped when its '/' and '!' lines are read, when its CRC checks
+ *  out, when publishing starts and when the last publish is written. PubSubClient
+ *  publishes with QoS 0 only and returns once the message is written to the TCP socket,
+ *  that is the last stamp.
+ */
+
+void latencyRecord(struct LatencyHistogram &histogram, unsigned long latency)
+{
+    int bucket = latency == 0 ? 0 : 32 - __builtin_clz(latency);
+    if (bucket >= LATENCY_BUCKETS)
+        bucket = LATENCY_BUCKETS - 1;
+
+    histogram.buckets[bucket]++;
+    histogram.count++;
+    if (latency > histogram.max)
+        histogram.max = latency;
+}
+
+/**
+ *  Records the stages of the last committed telegram, enqueued and written are the
+ *  micros() right before and right after sendDataToBroker().
+ */
+void latencyRecordTelegram(unsigned long enqueued, unsigned long written)
+{
+    unsigned long stages[LATENCY_STAGES];
+    stages[LATENCY_RECEIVE] = telegramEndMicros - telegramStartMicros;
+    stages[LATENCY_COMMIT] = telegramCommitMicros - telegramEndMicros;
+    stages[LATENCY_QUEUE] = enqueued - telegramCommitMicros;
+    stages[LATENCY_PUBLISH] = written - enqueued;
+    stages[LATENCY_TOTAL] = written - telegramStartMicros;
+
+    for (int s = 0; s < LATENCY_STAGES; s++)
+    {
+        latencyRecord(latencyHistograms[s], stages[s]);
+    }
+
+#ifdef LATENCY_TRACE
+    char payload[192];
+    int len = snprintf(payload, sizeof(payload), "{\"seq\":%lu,\"ts\":%lu", telegramSequence, meterTimestamp);
+    for (int s = 0; s < LATENCY_STAGES && len < (int)sizeof(payload); s++)
+    {
+        len += snprintf(payload + len, sizeof(payload) - len, ",\"%s_us\":%lu", latencyHistograms[s].name, stages[s]);
+    }
+    if (len < (int)sizeof(payload))
+        snprintf(payload + len, sizeof(payload) - len, "}");
+    sendMQTTMessage(MQTT_LATENCY_TOPIC "/trace", payload);
+#endif
+}
+
+/**
+ *  Publishes the histograms every LATENCY_PUBLISH_INTERVAL and clears them:
+ *  {"receive":{"count":60,"max_us":210345,"buckets":[0,0,...]},"commit":{...},...}
+ */
+void latencyPublish()
+{
+    long now = millis();
+    if (now - LAST_LATENCY_SENT < LATENCY_PUBLISH_INTERVAL || !mqttClient.connected())
+        return;
+    LAST_LATENCY_SENT = now;
+
+    char payload[MQTT_BUFFER_SIZE - 64];
+    int len = 0;
+    for (int s = 0; s < LATENCY_STAGES && len < (int)sizeof(payload); s++)
+    {
+        struct LatencyHistogram &histogram = latencyHistograms[s];
+        len += snprintf(payload + len, sizeof(payload) - len, "%c\"%s\":{\"count\":%lu,\"max_us\":%lu,\"buckets\":[",
+                        s == 0 ? '{' : ',', histogram.name, histogram.count, histogram.max);
+        for (int b = 0; b < LATENCY_BUCKETS && len < (int)sizeof(payload); b++)
+        {
+            len += snprintf(payload + len, sizeof(payload) - len, b == 0 ? "%lu" : ",%lu", histogram.buckets[b]);
+        }
+        if (len < (int)sizeof(payload))
+            len += snprintf(payload + len, sizeof(payload) - len, "]}");
+
+        histogram.count = 0;
+        histogram.max = 0;
+        memset(histogram.buckets, 0, sizeof(histogram.buckets));
+    }
+    if (len < (int)sizeof(payload))
+        snprintf(payload + len, sizeof(payload) - len, "}");
+
+    sendMQTTMessage(MQTT_LATENCY_TOPIC, payload);
+}
@@ -0,0 +1,54 @@
+/**
+ *  Logging macros.
+ *
+ *  LOG_ERROR(), LOG_WARN(), LOG_INFO() and LOG_DEBUG() take a printf format and at
+ *  most LOG_MAX_ARGS arguments. Messages above LOG_LEVEL are compiled out. The others
+ *  are not formatted where they are logged: the format pointer and the arguments,
+ *  as 32 bit words, are put in a lock-free ring and logDrain() formats and writes
+ *  them later from loop() (see logger.ino).
+ *
+ *  Because formatting is deferred, a %s argument must still be valid when the message
+ *  is drained: string literals, readout names and topics are fine, a String temporary
+ *  or a line buffer is not. Formats must only use 32 bit conversions (%d, %u, %ld,
+ *  %lu, %x, %s, %c).
+ */
+
+#pragma once
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+void logPush(int level, const char *format, const uint32_t *args);
+
+inline uint32_t logArg(const char *value) { return (uint32_t)(uintptr_t)value; }
+inline uint32_t logArg(char *value) { return (uint32_t)(uintptr_t)value; }
+// A String is gone before its message is drained, log its c_str() only when the String stays
+uint32_t logArg(const String &value) = delete;
+template <typename T>
+inline uint32_t logArg(T value) { return (uint32_t)value; }
+
+template <int level, typename... Args>
+inline void logAt(const char *format, Args... args)
+{
+    static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+    if (level > LOG_LEVEL)
+        return;
+    uint32_t values[LOG_MAX_ARGS] = {logArg(args)...};
+    logPush(level, format, values);
+}
+
+// The level check is repeated here so the arguments are not even evaluated when compiled out
+#define LOG_AT(level, ...)                  \
+    do                                      \
+    {                                       \
+        if (level <= LOG_LEVEL)             \
+            logAt<level>(__VA_ARGS__);      \
+    } while (0)
+
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
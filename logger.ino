@@ -0,0 +1,163 @@
+/**
+ *  Log ring, see logger.h.
+ *
+ *  A bounded multi-producer ring: every slot carries a sequence number. A producer
+ *  claims the slot at logHead with a compare-and-swap when the slot's sequence equals
+ *  the head, fills it and publishes it by setting the sequence to head + 1. The drain
+ *  takes the slot at logTail once its sequence is tail + 1 and hands it to the next
+ *  lap with tail + LOG_RING_SIZE. Nobody waits on anybody: when the ring is full a
+ *  message is only counted in logDropped.
+ */
+
+#define LOG_DRAIN_BATCH 8 // messages written per loop() pass
+#define LOG_LINE_LENGTH 160
+
+static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0, "LOG_RING_SIZE must be a power of two");
+static_assert(LOG_MAX_ARGS == 4, "logWriteNext() passes four arguments");
+
+void setupLogger()
+{
+    for (uint32_t i = 0; i < LOG_RING_SIZE; i++)
+    {
+        logRing[i].sequence = i;
+    }
+}
+
+void logPush(int level, const char *format, const uint32_t *args)
+{
+    uint32_t position = __atomic_load_n(&logHead, __ATOMIC_RELAXED);
+    struct LogRecord *record;
+    while (true)
+    {
+        record = &logRing[position & (LOG_RING_SIZE - 1)];
+        int32_t lap = (int32_t)(__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) - position);
+        if (lap == 0)
+        {
+            if (__atomic_compare_exchange_n(&logHead, &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (lap < 0)
+        {
+            // Not drained yet, the ring is full
+            __atomic_fetch_add(&logDropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else
+            position = __atomic_load_n(&logHead, __ATOMIC_RELAXED);
+    }
+
+    record->millis = millis();
+    record->format = format;
+    record->level = level;
+    memcpy(record->args, args, sizeof(record->args));
+    __atomic_store_n(&record->sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ *  Formats the oldest message and writes it to the enabled outputs. Returns false when
+ *  there is none, or when wait is false and the Serial TX buffer has no room for the rest
+ *  of it: what fits is written and the next call continues from there, so a message
+ *  longer than the TX buffer goes out over several passes.
+ */
+bool logWriteNext(bool wait)
+{
+    struct LogRecord *record = &logRing[logTail & (LOG_RING_SIZE - 1)];
+    if (__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) != logTail + 1)
+        return false;
+
+    // The oldest message stays formatted here until all of it is written
+    static char line[LOG_LINE_LENGTH];
+    static int len = 0;
+    static int written = 0;
+
+    if (len == 0)
+    {
+        static const char levels[] = "-EWID";
+        len = snprintf(line, sizeof(line), "%lu %c ", (unsigned long)record->millis, levels[record->level]);
+        len += snprintf(line + len, sizeof(line) - len, record->format,
+                        record->args[0], record->args[1], record->args[2], record->args[3]);
+        if (len > (int)sizeof(line) - 3)
+            len = sizeof(line) - 3;
+        line[len++] = '\r';
+        line[len++] = '\n';
+        line[len] = 0;
+        written = 0;
+    }
+
+#ifdef LOG_TO_SERIAL
+    int room = wait ? len - written : Serial.availableForWrite();
+    if (room < len - written)
+    {
+        if (room > 0)
+        {
+            Serial.write((const uint8_t *)line + written, room);
+            written += room;
+        }
+        return false;
+    }
+    Serial.write((const uint8_t *)line + written, len - written);
+#endif
+#ifdef LOG_TELNET_PORT
+    if (logClient.connected())
+        logClient.write((const uint8_t *)line, len);
+#endif
+#ifdef MQTT_LOG_TOPIC
+    if (mqttClient.connected())
+    {
+        line[len - 2] = 0;
+        mqttClient.publish(MQTT_LOG_TOPIC, line, false);
+    }
+#endif
+
+    len = 0;
+    __atomic_store_n(&record->sequence, logTail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+    logTail++;
+    return true;
+}
+
+/**
+ *  Accepts a telnet client, a new one replaces the current one.
+ */
+void logTelnetHandle()
+{
+#ifdef LOG_TELNET_PORT
+    static bool started = false;
+    if (!started && WiFi.status() == WL_CONNECTED)
+    {
+        logServer.begin();
+        logServer.setNoDelay(true);
+        started = true;
+    }
+    if (started && logServer.hasClient())
+    {
+        logClient.stop();
+        logClient = logServer.available();
+    }
+#endif
+}
+
+/**
+ *  Writes out up to LOG_DRAIN_BATCH messages, called from loop().
+ */
+void logDrain()
+{
+    logTelnetHandle();
+    for (int i = 0; i < LOG_DRAIN_BATCH && logWriteNext(false); i++)
+        ;
+
+    uint32_t dropped = __atomic_exchange_n(&logDropped, 0, __ATOMIC_RELAXED);
+    if (dropped > 0)
+        LOG_WARN("%u log messages dropped", dropped);
+}
+
+/**
+ *  Writes out every queued message, waiting for the outputs. Only for right before a restart.
+ */
+void logFlush()
+{
+    while (logWriteNext(true))
+        ;
+#ifdef LOG_TO_SERIAL
+    Serial.flush();
+#endif
+}
@@ -0,0 +1,199 @@
+/**
+ *  Modbus TCP server.
+ *
+ *  The register images are rebuilt once per committed telegram, a request only
+ *  copies words out of them, so the service time does not depend on the parser and
+ *  nothing is allocated. Function codes 3 (read holding registers) and 4 (read input
+ *  registers) are supported, any unit id is answered.
+ */
+
+#define MODBUS_READ_HOLDING_REGISTERS 0x03
+#define MODBUS_READ_INPUT_REGISTERS 0x04
+#define MODBUS_ILLEGAL_FUNCTION 0x01
+#define MODBUS_ILLEGAL_DATA_ADDRESS 0x02
+#define MODBUS_ILLEGAL_DATA_VALUE 0x03
+
+void setupModbus()
+{
+    for (unsigned int r = 0; r < sizeof(modbusFloatRegisters) / sizeof(modbusFloatRegisters[0]); r++)
+    {
+        modbusFloatRegisters[r].readoutIndex = findReadout(modbusFloatRegisters[r].readout);
+        modbusFloatRegisters[r].otherIndex = modbusFloatRegisters[r].other ? findReadout(modbusFloatRegisters[r].other) : -1;
+    }
+
+    modbusUpdateRegisters();
+    modbusServer.begin();
+    modbusServer.setNoDelay(true);
+}
+
+void modbusPutFloat(uint16_t address, float value)
+{
+    uint32_t raw;
+    memcpy(&raw, &value, sizeof(raw));
+    modbusInputRegisters[address] = raw >> 16;
+    modbusInputRegisters[address + 1] = raw & 0xFFFF;
+}
+
+/**
+ *  Rebuilds the register images from the shared snapshot, call after each committed telegram.
+ */
+void modbusUpdateRegisters()
+{
+    struct TelegramSnapshot snapshot;
+    snapshotRead(snapshot);
+
+    for (unsigned int r = 0; r < sizeof(modbusFloatRegisters) / sizeof(modbusFloatRegisters[0]); r++)
+    {
+        struct ModbusFloatRegister &reg = modbusFloatRegisters[r];
+        if (reg.readoutIndex < 0)
+            continue;
+
+        long value = snapshot.values[reg.readoutIndex];
+        if (reg.otherIndex >= 0)
+            value += reg.sign * snapshot.values[reg.otherIndex];
+        modbusPutFloat(reg.address, value * reg.scale);
+    }
+#ifdef MODBUS_NOMINAL_FREQUENCY
+    // 0x46 = Frequency, not in the telegram, stays 0 unless a nominal value is configured
+    modbusPutFloat(0x46, MODBUS_NOMINAL_FREQUENCY);
+#endif
+
+    for (int i = 0; i < numberOfReadouts; i++)
+    {
+        uint32_t raw = (uint32_t)snapshot.values[i];
+        modbusHoldingRegisters[2 * i] = raw >> 16;
+        modbusHoldingRegisters[2 * i + 1] = raw & 0xFFFF;
+    }
+}
+
+/**
+ *  Builds the response for the request in frame, in place. Returns the response length.
+ */
+int modbusProcess(uint8_t *frame)
+{
+    int length = (frame[4] << 8) | frame[5];
+    uint8_t function = frame[7];
+    uint16_t start = (frame[8] << 8) | frame[9];
+    uint16_t quantity = (frame[10] << 8) | frame[11];
+
+    const uint16_t *registers = NULL;
+    int registerCount = 0;
+    uint8_t exception = 0;
+
+    if (function == MODBUS_READ_HOLDING_REGISTERS)
+    {
+        registers = modbusHoldingRegisters;
+        registerCount = 2 * numberOfReadouts;
+    }
+    else if (function == MODBUS_READ_INPUT_REGISTERS)
+    {
+        registers = modbusInputRegisters;
+        registerCount = MODBUS_INPUT_REGISTERS;
+    }
+    else
+        exception = MODBUS_ILLEGAL_FUNCTION;
+
+    // Unit id, function code, start and quantity, anything else leaves start and quantity undefined
+    if (!exception && length != 6)
+        exception = MODBUS_ILLEGAL_DATA_VALUE;
+    else if (!exception && (quantity == 0 || quantity > 125))
+        exception = MODBUS_ILLEGAL_DATA_VALUE;
+    else if (!exception && start + quantity > registerCount)
+        exception = MODBUS_ILLEGAL_DATA_ADDRESS;
+
+    // Transaction id, protocol id and unit id are kept from the request
+    int pduLength;
+    if (exception)
+    {
+        frame[7] = function | 0x80;
+        frame[8] = exception;
+        pduLength = 2;
+    }
+    else
+    {
+        frame[8] = quantity * 2;
+        for (int r = 0; r < quantity; r++)
+        {
+            frame[9 + 2 * r] = registers[start + r] >> 8;
+            frame[10 + 2 * r] = registers[start + r] & 0xFF;
+        }
+        pduLength = 2 + quantity * 2;
+    }
+
+    // MBAP length counts the unit id and the PDU
+    frame[4] = (pduLength + 1) >> 8;
+    frame[5] = (pduLength + 1) & 0xFF;
+    return 7 + pduLength;
+}
+
+/**
+ *  Reads what the client sent so far into its frame, without waiting for the rest,
+ *  and answers every request that is complete.
+ */
+void modbusHandleClient(WiFiClient &client, struct ModbusFrame &frame)
+{
+    while (client.available() > 0)
+    {
+        // The MBAP header (7 bytes) holds the length of the rest of the request
+        int length = (frame.data[4] << 8) | frame.data[5];
+        int wanted = frame.length < 7 ? 7 : 6 + length;
+        int available = client.available();
+        int received = client.read(frame.data + frame.length, wanted - frame.length < available ? wanted - frame.length : available);
+        if (received <= 0)
+            return;
+        frame.length += received;
+        if (frame.length < 7)
+            continue;
+
+        length = (frame.data[4] << 8) | frame.data[5];
+        if (frame.data[2] != 0 || frame.data[3] != 0 || length < 2 || length + 6 > MODBUS_FRAME_SIZE)
+        {
+            // Not Modbus, drop the connection instead of trying to resync
+            client.stop();
+            frame.length = 0;
+            return;
+        }
+        if (frame.length < 6 + length)
+            continue;
+
+        unsigned long start = micros();
+        int responseLength = modbusProcess(frame.data);
+        client.write(frame.data, responseLength);
+        frame.length = 0;
+
+        unsigned long serviceTime = micros() - start;
+        if (serviceTime > modbusMaxServiceMicros)
+            modbusMaxServiceMicros = serviceTime;
+        modbusRequests++;
+    }
+}
+
+void modbusHandle()
+{
+    if (modbusServer.hasClient())
+    {
+        WiFiClient newClient = modbusServer.available();
+        int slot = -1;
+        for (int c = 0; c < MODBUS_MAX_CLIENTS && slot < 0; c++)
+        {
+            if (!modbusClients[c].connected())
+                slot = c;
+        }
+
+        if (slot >= 0)
+        {
+            modbusClients[slot].stop();
+            modbusClients[slot] = newClient;
+            modbusClients[slot].setNoDelay(true);
+            modbusFrames[slot].length = 0;
+        }
+        else
+            newClient.stop();
+    }
+
+    for (int c = 0; c < MODBUS_MAX_CLIENTS; c++)
+    {
+        if (modbusClients[c].connected())
+            modbusHandleClient(modbusClients[c], modbusFrames[c]);
+    }
+}
@@ -1,63 +1,133 @@
-void sendMQTTMessage(const char *topic, char *payload)
+bool sendMQTTMessage(const char *topic, char *payload)
 {
-    bool result = mqttClient.publish(topic, payload, false);
+    return mqttClient.publish(topic, payload, false);
 }
 
+/**
+ *  Makes one connection attempt, the caller decides when to retry.
+ *  Failed attempts are counted in MQTT_RECONNECT_RETRIES.
+ */
 bool mqttReconnect()
 {
-    int MQTT_RECONNECT_RETRIES = 0;
-
-    while (!mqttClient.connected() && MQTT_RECONNECT_RETRIES < MQTT_MAX_RECONNECT_TRIES)
+    if (mqttClient.connect(HOSTNAME, MQTT_USER, MQTT_PASS))
     {
-        MQTT_RECONNECT_RETRIES++;
+        char message[16 + sizeof(HOSTNAME)];
+        strcpy(message, "p1 meter alive: ");
+        strcat(message, HOSTNAME);
+        mqttClient.publish("hass/status", message);
+        mqttClient.subscribe(MQTT_HISTORY_REQUEST_TOPIC);
+        mqttClient.subscribe(MQTT_READOUT_TABLE_SET_TOPIC);
+        publishReadoutTable();
 
-        if (mqttClient.connect(HOSTNAME, MQTT_USER, MQTT_PASS))
-        {
-            char *message = new char[16 + strlen(HOSTNAME) + 1];
-            strcpy(message, "p1 meter alive: ");
-            strcat(message, HOSTNAME);
-            mqttClient.publish("hass/status", message);
-        }
-        else
-        {
-            delay(5000);
-        }
+        MQTT_RECONNECT_RETRIES = 0;
+        outboxStartReplay();
+        return true;
     }
 
-    if (MQTT_RECONNECT_RETRIES >= MQTT_MAX_RECONNECT_TRIES)
+    MQTT_RECONNECT_RETRIES++;
+    return false;
+}
+
+/**
+ *  Dispatches incoming messages on subscribed topics
+ */
+void mqttCallback(char *topic, uint8_t *payload, unsigned int length)
+{
+    if (strcmp(topic, MQTT_HISTORY_REQUEST_TOPIC) == 0)
     {
-        return false;
+        handleHistoryRequest(payload, length);
+    }
+    else if (strcmp(topic, MQTT_READOUT_TABLE_SET_TOPIC) == 0)
+    {
+        handleReadoutTableRequest(payload, length);
     }
-
-    return true;
 }
 
-void sendMetric(String name, long metric)
+bool sendMetric(const char *rootTopic, String name, long metric)
 {
     //if (metric > 0)
     //{
         char output[10];
         ltoa(metric, output, sizeof(output));
 
-        String topic = String(MQTT_ROOT_TOPIC) + "/" + name;
-#ifdef DEBUG
-        Serial.println(topic);
-#endif
-        sendMQTTMessage(topic.c_str(), output);
+        String topic = String(rootTopic) + "/" + name;
+        return sendMQTTMessage(topic.c_str(), output);
     //}
 }
 
-void sendDataToBroker()
+/**
+ *  Hands a new value to the publisher. Every readout has one outbound slot, its value
+ *  with sendData set: the latest value wins, so a value that is still waiting for its
+ *  interval or a congested link is replaced and counted in coalescedPublishes. However
+ *  long the broker is slow, nothing more than the readouts themselves is queued.
+ *  The UPDATE_FULL_INTERVAL refresh only sets sendData, replacing the value it
+ *  republishes loses nothing and is not counted.
+ */
+void readoutPut(struct TelegramDecodedObject &object, long value)
 {
-    for (int i = 0; i < NUMBER_OF_READOUTS; i++)
+    if (object.unpublished)
+        coalescedPublishes++;
+    object.value = value;
+    object.sendData = true;
+    object.unpublished = true;
+}
+
+/**
+ *  Publishes the pending readouts that are due, high priority first. A readout is due
+ *  when its interval has passed since it was last published. On a congested link
+ *  (a failed publish, or over MQTT_PUBLISH_BUDGET) the rest stays pending, with the
+ *  next telegram the high priority readouts go first again.
+ */
+void sendDataToBroker(struct P1Port &port)
+{
+    unsigned long start = micros();
+    unsigned long now = millis();
+    bool congested = false;
+
+    for (int priority = READOUT_PRIORITY_HIGH; priority <= READOUT_PRIORITY_LOW; priority++)
     {
-#ifdef DEBUG
-        Serial.println((String) "Sending: " + telegramObjects[i].name + " value: " + telegramObjects[i].value);
-#endif
-        if (telegramObjects[i].sendData)
+        for (int i = 0; i < numberOfReadouts; i++)
         {
-            sendMetric(telegramObjects[i].name, telegramObjects[i].value);
-            telegramObjects[i].sendData = false;
+            struct TelegramDecodedObject &object = port.objects[i];
+            // Derived readouts are only computed for the main meter
+            if (&port != &p1Ports[0] && object.code[0] == 0)
+                continue;
+            if (!object.sendData || object.priority != priority ||
+                (object.lastSent != 0 && now - object.lastSent < object.interval))
+                continue;
+
+            if (congested)
+            {
+                deferredPublishes++;
+                continue;
+            }
+
+            LOG_DEBUG("Sending %s/%s: %ld", port.topic, object.name.c_str(), object.value);
+            if (!sendMetric(port.topic, object.name, object.value))
+            {
+                congested = true;
+                deferredPublishes++;
+                continue;
+            }
+            object.sendData = false;
+            object.unpublished = false;
+            object.lastSent = now;
+            congested = micros() - start > MQTT_PUBLISH_BUDGET;
         }
     }
 }
+
+/**
+ *  Publishes the scheduler counters as JSON on MQTT_ROOT_TOPIC/publish.
+ */
+void publishSchedulerStats()
+{
+    long now = millis();
+    if (now - LAST_PUBLISH_STATS_SENT < P1_STATS_INTERVAL)
+        return;
+    LAST_PUBLISH_STATS_SENT = now;
+
+    char payload[64];
+    snprintf(payload, sizeof(payload), "{\"deferred\":%lu,\"coalesced\":%lu}", deferredPublishes, coalescedPublishes);
+    sendMQTTMessage(MQTT_ROOT_TOPIC "/publish", payload);
+}
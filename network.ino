@@ -0,0 +1,98 @@
+/**
+ *  WiFi without blocking.
+ *
+ *  setup() only starts connecting, loop() keeps reading the P1 ports while WiFi comes
+ *  up and starts the network services once it is there. After a restart the cached
+ *  access point lets WiFi.begin() skip the scan. When an attempt does not connect
+ *  within WIFI_CONNECT_TIMEOUT the cache is dropped and the next attempt scans.
+ */
+
+bool wifiCacheValid()
+{
+    return wifiCache.channel > 0 && wifiCache.crc == crc16(0x0000, (unsigned char *)&wifiCache, offsetof(struct WifiCache, crc));
+}
+
+void wifiConnect()
+{
+    LAST_WIFI_ATTEMPT = millis();
+    wifiFastConnect = wifiCacheValid();
+    if (wifiFastConnect)
+        WiFi.begin(WIFI_SSID, WIFI_PASS, wifiCache.channel, wifiCache.bssid);
+    else
+        WiFi.begin(WIFI_SSID, WIFI_PASS);
+}
+
+void setupWifi()
+{
+    WiFi.mode(WIFI_STA);
+#ifdef STATIC_IP
+    WiFi.config(IPAddress(STATIC_IP), IPAddress(STATIC_GATEWAY), IPAddress(STATIC_SUBNET), IPAddress(STATIC_DNS));
+#endif
+    wifiConnect();
+}
+
+/**
+ *  Called from loop(), returns true while WiFi is connected.
+ */
+bool wifiHandle()
+{
+    static bool connected = false;
+
+    if (WiFi.status() != WL_CONNECTED)
+    {
+        if (connected)
+        {
+            LOG_WARN("WiFi connection lost");
+            connected = false;
+            wifiConnect();
+        }
+        else if (millis() - LAST_WIFI_ATTEMPT > WIFI_CONNECT_TIMEOUT)
+        {
+            LOG_WARN(wifiFastConnect ? "WiFi connect timed out, retrying with a scan" : "WiFi connect timed out, retrying");
+            wifiCache.channel = 0;
+            WiFi.disconnect();
+            wifiConnect();
+        }
+        return false;
+    }
+
+    if (!connected)
+    {
+        connected = true;
+        if (wifiConnectedMillis == 0)
+            wifiConnectedMillis = millis();
+
+        memcpy(wifiCache.bssid, WiFi.BSSID(), sizeof(wifiCache.bssid));
+        wifiCache.channel = WiFi.channel();
+        wifiCache.crc = crc16(0x0000, (unsigned char *)&wifiCache, offsetof(struct WifiCache, crc));
+
+        IPAddress ip = WiFi.localIP();
+        LOG_INFO("WiFi connected on channel %d", wifiCache.channel);
+        LOG_INFO("IP address: %u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+
+        if (!networkStarted)
+        {
+            setupOTA();
+            setupHttpServer();
+            setupModbus();
+            networkStarted = true;
+        }
+    }
+    return true;
+}
+
+/**
+ *  Called once, after the first readout of this boot was published. Publishes the
+ *  boot timings (milliseconds since boot) retained on MQTT_BOOT_TOPIC.
+ */
+void publishBootReport()
+{
+    firstPublishMillis = millis();
+    LOG_INFO("First value published %lu ms after boot", firstPublishMillis);
+
+    char payload[160];
+    snprintf(payload, sizeof(payload),
+             "{\"reset_reason\":%d,\"fast_connect\":%s,\"wifi_ms\":%lu,\"first_publish_ms\":%lu}",
+             (int)esp_reset_reason(), wifiFastConnect ? "true" : "false", wifiConnectedMillis, firstPublishMillis);
+    mqttClient.publish(MQTT_BOOT_TOPIC, payload, true);
+}
@@ -0,0 +1,240 @@
+/**
+ *  Store-and-forward outbox.
+ *
+ *  While the broker is unreachable every committed telegram is kept as a snapshot in
+ *  a small RAM ring. When that ring is full the oldest OUTBOX_SPILL_BATCH snapshots are
+ *  written in one go to a ring file on LittleFS, so flash sees few, large writes that
+ *  walk over the whole file. Flash always holds the older part of the backlog, RAM the
+ *  newer part, so replaying flash first and RAM second keeps the original order.
+ */
+
+#define OUTBOX_MAGIC 0x50314f42 // "P1OB"
+
+void setupOutbox()
+{
+    if (!LittleFS.begin(true))
+    {
+        LOG_ERROR("Outbox: mounting LittleFS failed, only RAM buffering available");
+        return;
+    }
+
+    File stateFile = LittleFS.open(OUTBOX_STATE_FILE, "r");
+    bool loaded = stateFile && stateFile.read((uint8_t *)&outboxState, sizeof(outboxState)) == sizeof(outboxState);
+    if (stateFile)
+        stateFile.close();
+
+    // A changed record layout or readout table makes the old ring unreadable, start over
+    if (!loaded || outboxState.magic != OUTBOX_MAGIC || outboxState.recordSize != sizeof(OutboxRecord) ||
+        outboxState.tableCrc != readoutTableCrc)
+    {
+        outboxState.magic = OUTBOX_MAGIC;
+        outboxState.recordSize = sizeof(OutboxRecord);
+        outboxState.tableCrc = readoutTableCrc;
+        outboxState.head = 0;
+        outboxState.tail = 0;
+        LittleFS.remove(OUTBOX_FLASH_FILE);
+        saveOutboxState();
+    }
+
+    LOG_INFO("Outbox: %lu telegrams waiting in flash", outboxState.head - outboxState.tail);
+}
+
+void saveOutboxState()
+{
+    File stateFile = LittleFS.open(OUTBOX_STATE_FILE, "w");
+    if (stateFile)
+    {
+        stateFile.write((uint8_t *)&outboxState, sizeof(outboxState));
+        stateFile.close();
+    }
+}
+
+bool outboxIsEmpty()
+{
+    return outboxRamCount == 0 && outboxState.head == outboxState.tail;
+}
+
+/**
+ *  Stores the current telegram values. Call this instead of sendDataToBroker()
+ *  when the broker is not connected.
+ */
+void outboxPush()
+{
+    if (outboxRamCount == OUTBOX_RAM_SLOTS)
+    {
+        outboxSpill(OUTBOX_SPILL_BATCH);
+    }
+
+    // Spilling failed (no filesystem), drop the oldest snapshot in RAM
+    if (outboxRamCount == OUTBOX_RAM_SLOTS)
+    {
+        outboxRamFirst = (outboxRamFirst + 1) % OUTBOX_RAM_SLOTS;
+        outboxRamCount--;
+        outboxDropped++;
+    }
+
+    struct TelegramSnapshot &snapshot = outboxRam[(outboxRamFirst + outboxRamCount) % OUTBOX_RAM_SLOTS];
+    snapshot.sequence = telegramSequence;
+    snapshot.timestamp = meterTimestamp;
+    for (int i = 0; i < numberOfReadouts; i++)
+    {
+        snapshot.values[i] = telegramObjects[i].value;
+    }
+    outboxRamCount++;
+}
+
+/**
+ *  Moves the oldest count snapshots from RAM to the flash ring.
+ */
+void outboxSpill(int count)
+{
+    if (count > outboxRamCount)
+        count = outboxRamCount;
+    if (count == 0 || outboxState.magic != OUTBOX_MAGIC)
+        return;
+
+    if (!LittleFS.exists(OUTBOX_FLASH_FILE))
+    {
+        File created = LittleFS.open(OUTBOX_FLASH_FILE, "w");
+        if (!created)
+            return;
+        created.close();
+    }
+
+    File ring = LittleFS.open(OUTBOX_FLASH_FILE, "r+");
+    if (!ring)
+        return;
+
+    struct OutboxRecord record;
+    for (int i = 0; i < count; i++)
+    {
+        record.snapshot = outboxRam[outboxRamFirst];
+        record.crc = crc16(0x0000, (unsigned char *)&record.snapshot, sizeof(record.snapshot));
+
+        // The file only grows until the ring wraps, so the seek never passes the end of the file
+        ring.seek((outboxState.head % OUTBOX_FLASH_SLOTS) * sizeof(record));
+        if (ring.write((uint8_t *)&record, sizeof(record)) != sizeof(record))
+            break;
+
+        outboxState.head++;
+        if (outboxState.head - outboxState.tail > OUTBOX_FLASH_SLOTS)
+        {
+            // Ring is full, the oldest telegram is overwritten
+            outboxState.tail++;
+            outboxDropped++;
+        }
+
+        outboxRamFirst = (outboxRamFirst + 1) % OUTBOX_RAM_SLOTS;
+        outboxRamCount--;
+    }
+    ring.close();
+    saveOutboxState();
+}
+
+/**
+ *  Writes everything still in RAM to flash, used right before a reboot.
+ */
+void outboxFlush()
+{
+    outboxSpill(outboxRamCount);
+}
+
+/**
+ *  Called after (re)connecting to the broker. The replay starts after a random
+ *  holdoff so a fleet that reconnects at the same time does not replay at the same time.
+ */
+void outboxStartReplay()
+{
+    outboxReplayHoldoff = random(OUTBOX_REPLAY_HOLDOFF);
+    LAST_OUTBOX_REPLAY = millis();
+}
+
+bool outboxPeek(struct TelegramSnapshot &snapshot)
+{
+    if (outboxState.head != outboxState.tail)
+    {
+        File ring = LittleFS.open(OUTBOX_FLASH_FILE, "r");
+        struct OutboxRecord record;
+        bool valid = ring && ring.seek((outboxState.tail % OUTBOX_FLASH_SLOTS) * sizeof(record)) &&
+                     ring.read((uint8_t *)&record, sizeof(record)) == sizeof(record) &&
+                     record.crc == crc16(0x0000, (unsigned char *)&record.snapshot, sizeof(record.snapshot));
+        if (ring)
+            ring.close();
+
+        if (!valid)
+        {
+            // Corrupt record, skip it
+            outboxState.tail++;
+            outboxDropped++;
+            return false;
+        }
+        snapshot = record.snapshot;
+        return true;
+    }
+
+    if (outboxRamCount > 0)
+    {
+        snapshot = outboxRam[outboxRamFirst];
+        return true;
+    }
+
+    return false;
+}
+
+void outboxPop()
+{
+    if (outboxState.head != outboxState.tail)
+    {
+        outboxState.tail++;
+        // Persist progress per batch, after a reboot at most one batch is replayed twice
+        if (outboxState.tail % OUTBOX_SPILL_BATCH == 0 || outboxState.head == outboxState.tail)
+            saveOutboxState();
+    }
+    else if (outboxRamCount > 0)
+    {
+        outboxRamFirst = (outboxRamFirst + 1) % OUTBOX_RAM_SLOTS;
+        outboxRamCount--;
+    }
+}
+
+/**
+ *  Publishes the oldest buffered telegram as one JSON message on MQTT_BACKLOG_TOPIC,
+ *  at most once every OUTBOX_REPLAY_INTERVAL milliseconds.
+ */
+void outboxReplay()
+{
+    long now = millis();
+    if (outboxIsEmpty() || now - LAST_OUTBOX_REPLAY < OUTBOX_REPLAY_INTERVAL + outboxReplayHoldoff)
+        return;
+
+    LAST_OUTBOX_REPLAY = now;
+    outboxReplayHoldoff = 0;
+
+    struct TelegramSnapshot snapshot;
+    if (!outboxPeek(snapshot))
+        return;
+
+    char payload[OUTBOX_JSON_SIZE];
+    int len = snprintf(payload, sizeof(payload), "{\"ts\":%lu,\"seq\":%lu", snapshot.timestamp, snapshot.sequence);
+    for (int i = 0; i < numberOfReadouts && len < (int)sizeof(payload); i++)
+    {
+        len += snprintf(payload + len, sizeof(payload) - len, ",\"%s\":%ld", telegramObjects[i].name.c_str(), snapshot.values[i]);
+    }
+    if (len < (int)sizeof(payload))
+        len += snprintf(payload + len, sizeof(payload) - len, "}");
+    if (len >= (int)sizeof(payload))
+    {
+        // Only with names longer than READOUT_NAME_SIZE, a cut off object is no use to anyone
+        LOG_ERROR("Outbox: telegram %lu does not fit in %d bytes, dropped", snapshot.sequence, OUTBOX_JSON_SIZE);
+        outboxPop();
+        return;
+    }
+
+    // Streamed, a telegram with all readouts can be longer than the MQTT buffer.
+    // Kept for the next attempt when the publish fails.
+    if (mqttClient.beginPublish(MQTT_BACKLOG_TOPIC, len, false) && mqttClient.write((const uint8_t *)payload, len) == (size_t)len &&
+        mqttClient.endPublish())
+    {
+        outboxPop();
+    }
+}
@@ -0,0 +1,152 @@
+/**
+ *  Meter powered operation (POWER_SAVE).
+ *
+ *  The CPU runs at POWER_CPU_MHZ and WiFi stays in modem sleep, the radio only wakes
+ *  for the DTIM beacons of the access point and to send. When the core is built with CONFIG_PM_ENABLE the chip also light-sleeps whenever
+ *  loop() waits. The UART is stopped in light sleep and the bytes that wake it are
+ *  lost, so powerLock blocks light sleep from POWER_WAKE_AHEAD milliseconds before
+ *  the next expected telegram until its '!'. The expected time comes from the period
+ *  each port learns from its own telegrams, until a port has one it stays awake.
+ *
+ *  powerReport() publishes the awake duty cycle and the average current estimated
+ *  from it, against POWER_BUDGET_MA.
+ */
+
+#ifdef POWER_SAVE
+
+#define POWER_PERIOD_OUTLIERS 3 // longer intervals in a row that replace the period
+
+void setupPower()
+{
+    setCpuFrequencyMhz(POWER_CPU_MHZ);
+    WiFi.setSleep(true);
+    LAST_POWER_REPORT = millis();
+
+#if CONFIG_PM_ENABLE
+    // The APB clock, and with it the UART baud rate, stays at 80 MHz
+    esp_pm_config_esp32_t config = {POWER_CPU_MHZ, POWER_CPU_MHZ, true};
+    if (esp_pm_configure(&config) == ESP_OK && esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "p1", &powerLock) == ESP_OK)
+    {
+        esp_pm_lock_acquire(powerLock);
+        powerAwake = true;
+        powerLightSleep = true;
+
+        // Wakes on a start bit (P1 is inverted) when a telegram comes in unexpectedly,
+        // the parser picks up again at the next '/'
+        for (int p = 0; p < P1_PORTS; p++)
+            gpio_wakeup_enable((gpio_num_t)p1Ports[p].rxPin, GPIO_INTR_HIGH_LEVEL);
+        esp_sleep_enable_gpio_wakeup();
+    }
+#endif
+
+    if (powerLightSleep)
+        LOG_INFO("Power save: %d MHz, light sleep between telegrams", POWER_CPU_MHZ);
+    else
+        LOG_INFO("Power save: %d MHz, modem sleep only", POWER_CPU_MHZ);
+}
+
+/**
+ *  Called at the '!' of every telegram, valid or not. The period follows shorter
+ *  intervals right away and longer ones slowly, a missed telegram (twice the period
+ *  or more) is ignored unless it keeps happening.
+ */
+void powerTelegramEnd(struct P1Port &port)
+{
+    unsigned long now = millis();
+    unsigned long previous = port.lastEndMillis;
+    port.lastEndMillis = now;
+    if (previous == 0)
+        return;
+
+    unsigned long interval = now - previous;
+    if (port.period == 0 || interval <= port.period)
+        port.period = interval;
+    else if (interval < port.period + port.period / 2)
+        port.period += (interval - port.period) / 8;
+    else if (++port.periodOutliers >= POWER_PERIOD_OUTLIERS)
+        port.period = interval;
+    else
+        return;
+    port.periodOutliers = 0;
+}
+
+/**
+ *  True while light sleep would lose bytes of the port's next telegram.
+ */
+bool powerPortExpectsTelegram(struct P1Port &port, unsigned long now)
+{
+    if (port.inTelegram || port.period == 0)
+        return true;
+
+    unsigned long receive = (port.endMicros - port.startMicros) / 1000;
+    unsigned long quiet = port.period > receive + POWER_WAKE_AHEAD ? port.period - receive - POWER_WAKE_AHEAD : 0;
+    return now - port.lastEndMillis >= quiet;
+}
+
+/**
+ *  Takes or releases powerLock, called by loopWait() before it waits.
+ */
+void powerUpdate()
+{
+    if (!powerLightSleep)
+        return;
+
+    unsigned long now = millis();
+    bool awake = loopHasP1Data();
+    for (int p = 0; p < P1_PORTS && !awake; p++)
+        awake = powerPortExpectsTelegram(p1Ports[p], now);
+
+    if (awake == powerAwake)
+        return;
+    if (awake)
+        esp_pm_lock_acquire(powerLock);
+    else
+        esp_pm_lock_release(powerLock);
+    powerAwake = awake;
+}
+
+void powerWaited(unsigned long waited)
+{
+    if (powerLightSleep && !powerAwake)
+        powerSleepMicros += waited;
+    else
+        powerIdleMicros += waited;
+}
+
+/**
+ *  Publishes the duty cycle every POWER_REPORT_INTERVAL, called from every loop() pass.
+ *  The window restarts on every interval, also while MQTT is down and nothing is
+ *  published. The current is an estimate from the POWER_*_MA constants, not a
+ *  measurement.
+ */
+void powerReport()
+{
+    unsigned long window = millis() - LAST_POWER_REPORT;
+    if (window < POWER_REPORT_INTERVAL)
+        return;
+    LAST_POWER_REPORT = millis();
+
+    unsigned long idle = powerIdleMicros / 1000;
+    unsigned long sleep = powerSleepMicros / 1000;
+    powerIdleMicros = 0;
+    powerSleepMicros = 0;
+    if (!mqttClient.connected())
+        return;
+    if (sleep > window)
+        sleep = window;
+    if (idle + sleep > window)
+        idle = window - sleep;
+    unsigned long active = window - idle - sleep;
+
+    unsigned long current = (active * POWER_ACTIVE_MA + idle * POWER_IDLE_MA + sleep * POWER_SLEEP_MA) / window + POWER_WIFI_MA;
+    if (current > POWER_BUDGET_MA)
+        LOG_WARN("Estimated %lu mA, over the budget of %d mA", current, POWER_BUDGET_MA);
+
+    char payload[160];
+    snprintf(payload, sizeof(payload),
+             "{\"period_ms\":%lu,\"active_pct\":%lu,\"sleep_pct\":%lu,\"current_ma\":%lu,\"budget_ma\":%d}",
+             p1Ports[0].period, active * 100 / window, sleep * 100 / window, current, POWER_BUDGET_MA);
+    mqttClient.publish(MQTT_POWER_TOPIC, payload, false);
+}
+
+#endif
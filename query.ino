@@ -0,0 +1,327 @@
+/**
+ *  Range queries over the on-device history.
+ *
+ *  HTTP:  GET /history?from=<utc seconds>&to=<utc seconds>&fields=<name,name>&tier=<raw|1m|15m|1h>&format=<csv|bin>
+ *  MQTT:  publish the same query string (from=...&to=...) to MQTT_HISTORY_REQUEST_TOPIC,
+ *         the response is sent in chunks to MQTT_HISTORY_RESPONSE_TOPIC followed by an empty message.
+ *
+ *  All parameters are optional, by default all readouts of the raw history are returned as CSV.
+ *  Binary rows are little endian: uint32 timestamp followed by an int32 per selected readout,
+ *  or min, max and mean per selected readout for a tier.
+ *
+ *  A query runs inside loop(), so one response holds at most QUERY_MAX_ROWS rows and takes at
+ *  most QUERY_TIME_BUDGET ms, after which the P1 ports are served again. A response that stops
+ *  early ends with "next=<utc seconds>" as its last CSV line, or in binary a row with timestamp 0
+ *  followed by the uint32 of that timestamp. Repeating the query with that value as from returns
+ *  the next page.
+ */
+
+void setupHistoryApi()
+{
+    httpServer.on("/history", HTTP_GET, []() {
+        struct HistoryQuery query;
+        parseHistoryQuery(query, httpServer.arg("from").c_str(), httpServer.arg("to").c_str(),
+                          httpServer.arg("fields").c_str(), httpServer.arg("tier").c_str(), httpServer.arg("format").c_str());
+
+        if (query.tier == -2)
+        {
+            httpServer.send(400, "text/plain", "Unknown tier");
+            return;
+        }
+
+        httpServer.setContentLength(CONTENT_LENGTH_UNKNOWN);
+        httpServer.send(200, query.binary ? "application/octet-stream" : "text/csv", "");
+
+        struct QueryOutput output;
+        output.toMqtt = false;
+        output.length = 0;
+        runHistoryQuery(query, output);
+
+        // An empty chunk ends the chunked response
+        httpServer.sendContent("");
+    });
+}
+
+void parseHistoryQuery(struct HistoryQuery &query, const char *from, const char *to, const char *fields, const char *tier, const char *format)
+{
+    query.from = *from ? strtoul(from, NULL, 10) : 0;
+    query.to = *to ? strtoul(to, NULL, 10) : 0xFFFFFFFF;
+    query.binary = strcmp(format, "bin") == 0;
+
+    query.tier = -1;
+    if (*tier && strcmp(tier, "raw") != 0)
+        query.tier = rollupTierByName(tier) >= 0 ? rollupTierByName(tier) : -2;
+
+    for (int i = 0; i < numberOfReadouts; i++)
+    {
+        if (*fields == 0)
+        {
+            query.fields[i] = true;
+            continue;
+        }
+
+        // Look for the name as a complete item of the comma separated list
+        int nameLength = telegramObjects[i].name.length();
+        const char *match = strstr(fields, telegramObjects[i].name.c_str());
+        query.fields[i] = false;
+        while (match != NULL && !query.fields[i])
+        {
+            query.fields[i] = (match == fields || match[-1] == ',') && (match[nameLength] == ',' || match[nameLength] == 0);
+            match = strstr(match + 1, telegramObjects[i].name.c_str());
+        }
+    }
+}
+
+/**
+ *  Copies the value of key from a query string like "from=1&to=2" into value.
+ */
+void queryStringParam(const char *queryString, const char *key, char *value, int size)
+{
+    int keyLength = strlen(key);
+    value[0] = 0;
+
+    const char *p = queryString;
+    while (*p)
+    {
+        if (strncmp(p, key, keyLength) == 0 && p[keyLength] == '=')
+        {
+            p += keyLength + 1;
+            int len = 0;
+            while (p[len] && p[len] != '&' && len < size - 1)
+            {
+                value[len] = p[len];
+                len++;
+            }
+            value[len] = 0;
+            return;
+        }
+
+        const char *next = strchr(p, '&');
+        if (next == NULL)
+            return;
+        p = next + 1;
+    }
+}
+
+void handleHistoryRequest(const uint8_t *payload, unsigned int length)
+{
+    // The payload points into the MQTT client buffer, which is reused when we publish
+    char request[256];
+    if (length >= sizeof(request))
+        length = sizeof(request) - 1;
+    memcpy(request, payload, length);
+    request[length] = 0;
+
+    char from[12], to[12], fields[160], tier[8], format[8];
+    queryStringParam(request, "from", from, sizeof(from));
+    queryStringParam(request, "to", to, sizeof(to));
+    queryStringParam(request, "fields", fields, sizeof(fields));
+    queryStringParam(request, "tier", tier, sizeof(tier));
+    queryStringParam(request, "format", format, sizeof(format));
+
+    struct HistoryQuery query;
+    parseHistoryQuery(query, from, to, fields, tier, format);
+    if (query.tier == -2)
+    {
+        mqttClient.publish(MQTT_HISTORY_RESPONSE_TOPIC, "error: unknown tier", false);
+        return;
+    }
+
+    struct QueryOutput output;
+    output.toMqtt = true;
+    output.length = 0;
+    runHistoryQuery(query, output);
+
+    // An empty message ends the response
+    mqttClient.publish(MQTT_HISTORY_RESPONSE_TOPIC, "", false);
+}
+
+/**
+ *  Sends data as one chunk of the response. Streamed to MQTT, a row can be longer
+ *  than the MQTT buffer.
+ */
+void querySend(struct QueryOutput &output, const char *data, int length)
+{
+    if (output.toMqtt)
+    {
+        mqttClient.beginPublish(MQTT_HISTORY_RESPONSE_TOPIC, length, false);
+        mqttClient.write((const uint8_t *)data, length);
+        mqttClient.endPublish();
+    }
+    else
+        httpServer.sendContent(data, length);
+}
+
+void queryFlush(struct QueryOutput &output)
+{
+    if (output.length == 0)
+        return;
+
+    querySend(output, output.buffer, output.length);
+    output.length = 0;
+}
+
+/**
+ *  Adds a row to the output. Rows are never split over two chunks, so every
+ *  MQTT response message holds complete rows. A row longer than a chunk, like
+ *  the header of a tier query, is a chunk of its own.
+ */
+void queryWrite(struct QueryOutput &output, const char *row, int length)
+{
+    if (output.length + length > QUERY_CHUNK_SIZE)
+        queryFlush(output);
+
+    if (length > QUERY_CHUNK_SIZE)
+    {
+        querySend(output, row, length);
+        return;
+    }
+
+    memcpy(output.buffer + output.length, row, length);
+    output.length += length;
+}
+
+/**
+ *  Appends formatted text to a row of QUERY_ROW_SIZE, what does not fit is cut off
+ *  and one byte stays free for the '\n'.
+ */
+int queryAppendText(char *row, int length, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int room = QUERY_ROW_SIZE - 1 - length;
+    int n = vsnprintf(row + length, room, format, args);
+    va_end(args);
+    return n < room ? length + n : QUERY_ROW_SIZE - 2;
+}
+
+int queryAppendInt(char *row, int length, long value, bool binary)
+{
+    if (binary)
+    {
+        uint32_t raw = (uint32_t)value;
+        for (int b = 0; b < 4; b++)
+        {
+            row[length++] = (raw >> (8 * b)) & 0xFF;
+        }
+        return length;
+    }
+    return length + sprintf(row + length, length == 0 ? "%ld" : ",%ld", value);
+}
+
+/**
+ *  Returns true when the current response is full, see QUERY_MAX_ROWS and QUERY_TIME_BUDGET.
+ */
+bool queryPageFull(int rows, unsigned long started)
+{
+    return rows >= QUERY_MAX_ROWS || millis() - started >= QUERY_TIME_BUDGET;
+}
+
+void runHistoryQuery(struct HistoryQuery &query, struct QueryOutput &output)
+{
+    unsigned long started = millis();
+    unsigned long next = 0;
+    bool more = false;
+    int rows = 0;
+
+    // Too large for the loop() stack, see QUERY_ROW_SIZE
+    static char row[QUERY_ROW_SIZE];
+    int length;
+
+    if (!query.binary)
+    {
+        length = queryAppendText(row, 0, "timestamp");
+        if (query.tier >= 0)
+            length = queryAppendText(row, length, ",count");
+        for (int i = 0; i < numberOfReadouts; i++)
+        {
+            if (!query.fields[i])
+                continue;
+
+            const char *name = telegramObjects[i].name.c_str();
+            if (query.tier < 0)
+                length = queryAppendText(row, length, ",%s", name);
+            else if (telegramObjects[i].counter)
+                length = queryAppendText(row, length, ",%s_first,%s_last,%s_delta", name, name, name);
+            else
+                length = queryAppendText(row, length, ",%s_min,%s_max,%s_mean", name, name, name);
+        }
+        row[length++] = '\n';
+        queryWrite(output, row, length);
+    }
+
+    if (query.tier < 0)
+    {
+        struct HistoryCursor cursor;
+        historySeekBlock(cursor, historyFindBlock(query.from));
+        while (historyNext(cursor) && cursor.timestamp <= query.to)
+        {
+            if (cursor.timestamp < query.from)
+                continue;
+            if (queryPageFull(rows, started))
+            {
+                next = cursor.timestamp;
+                more = true;
+                break;
+            }
+
+            length = queryAppendInt(row, 0, cursor.timestamp, query.binary);
+            for (int i = 0; i < numberOfReadouts; i++)
+            {
+                if (query.fields[i])
+                    length = queryAppendInt(row, length, cursor.values[i], query.binary);
+            }
+            if (!query.binary)
+                row[length++] = '\n';
+            queryWrite(output, row, length);
+            rows++;
+        }
+    }
+    else
+    {
+        for (int n = rollupFind(query.tier, query.from); n < rollupTiers[query.tier].used; n++)
+        {
+            struct RollupBucket *bucket = rollupBucketAt(query.tier, n);
+            if (bucket->start > query.to)
+                break;
+            if (queryPageFull(rows, started))
+            {
+                next = bucket->start;
+                more = true;
+                break;
+            }
+
+            length = queryAppendInt(row, 0, bucket->start, query.binary);
+            if (!query.binary)
+                length = queryAppendInt(row, length, bucket->count, false);
+            for (int i = 0; i < numberOfReadouts; i++)
+            {
+                if (!query.fields[i])
+                    continue;
+
+                length = queryAppendInt(row, length, bucket->min[i], query.binary);
+                length = queryAppendInt(row, length, bucket->max[i], query.binary);
+                length = queryAppendInt(row, length, telegramObjects[i].counter ? bucket->max[i] - bucket->min[i] : bucket->mean[i], query.binary);
+            }
+            if (!query.binary)
+                row[length++] = '\n';
+            queryWrite(output, row, length);
+            rows++;
+        }
+    }
+
+    if (more)
+    {
+        // Samples within the same second would make the next page start at this one forever
+        if (next == query.from)
+            next++;
+
+        if (query.binary)
+            length = queryAppendInt(row, queryAppendInt(row, 0, 0, true), next, true);
+        else
+            length = sprintf(row, "next=%lu\n", next);
+        queryWrite(output, row, length);
+    }
+
+    queryFlush(output);
+}
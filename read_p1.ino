@@ -45,7 +45,7 @@ int findCharInArrayRev(char array[], char c, int len)
     return -1;
 }
 
-long getValue(char *buffer, int maxlen, char startchar, char endchar)
+long getValue(char *buffer, int maxlen, char startchar, char endchar, long scale)
 {
     int s = findCharInArrayRev(buffer, startchar, maxlen - 2);
     int l = findCharInArrayRev(buffer, endchar, maxlen - 2) - s - 1;
@@ -53,12 +53,16 @@ long getValue(char *buffer, int maxlen, char startchar, char endchar)
     char res[16];
     memset(res, 0, sizeof(res));
 
+    // Corrupted line, the delimiters are missing or out of order
+    if (s < 0 || l <= 0 || l >= (int)sizeof(res))
+        return 0;
+
     if (strncpy(res, buffer + s + 1, l))
     {
         if (endchar == '*')
         {
             if (isNumber(res, l))
-                return (1000 * atof(res));
+                return (scale * atof(res));
         }
         else if (endchar == ')')
         {
@@ -71,100 +75,394 @@ long getValue(char *buffer, int maxlen, char startchar, char endchar)
 }
 
 /**
- *  Decodes the telegram PER line. Not the complete message. 
+ *  Opens the UART of every P1 port and points it at its readout values.
+ *  Call after the readout table is set up.
  */
-bool decodeTelegram(int len)
+void setupP1Ports()
 {
-    int startChar = findCharInArrayRev(telegram, '/', len);
-    int endChar = findCharInArrayRev(telegram, '!', len);
-    bool validCRCFound = false;
+    p1Ports[0].serial = &Serial2;
+    p1Ports[0].uart = UART_NUM_2;
+    p1Ports[0].rxPin = RXD2;
+    p1Ports[0].txPin = TXD2;
+    p1Ports[0].topic = MQTT_ROOT_TOPIC;
+    p1Ports[0].objects = telegramObjects;
+    Serial2.setRxBufferSize(P1_RX_BUFFER_SIZE);
+#ifdef P1_REPEATER
+    Serial2.setTxBufferSize(P1_REPEATER_BUFFER);
+#endif
 
-#ifdef DEBUG
-    for (int cnt = 0; cnt < len; cnt++)
+#ifdef P1_SECOND_PORT
+    // The sub-meter uses the same readout table
+    for (int i = 0; i < numberOfReadouts; i++)
     {
-        Serial.print(telegram[cnt]);
+        subMeterObjects[i] = telegramObjects[i];
     }
-    Serial.print("\n");
+    p1Ports[1].serial = &Serial1;
+    p1Ports[1].uart = UART_NUM_1;
+    p1Ports[1].rxPin = RXD1;
+    p1Ports[1].txPin = TXD1;
+    p1Ports[1].topic = MQTT_PORT2_ROOT_TOPIC;
+    p1Ports[1].objects = subMeterObjects;
+    Serial1.setRxBufferSize(P1_RX_BUFFER_SIZE);
+#ifdef P1_REPEATER
+    Serial1.setTxBufferSize(P1_REPEATER_BUFFER);
+#endif
+#endif
+
+    for (int p = 0; p < P1_PORTS; p++)
+    {
+#if defined(P1_REPEATER) && defined(P1_REPEATER_CRC_ONLY)
+        p1Ports[p].repeatLength = 0;
 #endif
+        setupP1SerialConfig(p1Ports[p], p);
+    }
+}
+
+/**
+ *  (Re)starts the UART of a port with its current serial settings.
+ */
+void p1PortBegin(struct P1Port &port)
+{
+    struct P1SerialConfig &config = p1SerialConfigs[port.config];
+    port.serial->end();
+    port.serial->begin(config.baud, config.framing, port.rxPin, port.txPin, true);
+    setupRepeater(port.uart);
+    port.serial->onReceive(loopWakeP1);
+
+    port.rxPosition = 0;
+    port.rxLength = 0;
+    port.inTelegram = false;
+    port.lineLength = 0;
+    port.currentCRC = 0;
+}
+
+/**
+ *  Decodes the telegram PER line. Not the complete message. 
+ */
+bool decodeTelegram(struct P1Port &port, int len)
+{
+    char *telegram = port.telegram;
+    int startChar = findCharInArrayRev(telegram, '/', len);
+    int endChar = findCharInArrayRev(telegram, '!', len);
+    bool validCRCFound = false;
 
     if (startChar >= 0)
     {
         // * Start found. Reset CRC calculation
-        currentCRC = crc16(0x0000, (unsigned char *)telegram + startChar, len - startChar);
+        if (port.telegramLines > 0)
+            port.truncatedTelegrams++; // a new telegram started before the '!' of this one
+        port.telegramLines = 0;
+        port.startMicros = micros();
+        port.timestamp = 0;
+        port.peakTimestamp = 0;
+        port.currentCRC = crc16(0x0000, (unsigned char *)telegram + startChar, len - startChar);
+        memset(port.stagedFound, 0, sizeof(port.stagedFound));
     }
     else if (endChar >= 0)
     {
+        port.endMicros = micros();
+        port.inTelegram = false;
+#ifdef POWER_SAVE
+        powerTelegramEnd(port);
+#endif
+        port.telegramLines = 0;
+
         // * Add to crc calc
-        currentCRC = crc16(currentCRC, (unsigned char *)telegram + endChar, 1);
+        port.currentCRC = crc16(port.currentCRC, (unsigned char *)telegram + endChar, 1);
 
         char messageCRC[5];
         strncpy(messageCRC, telegram + endChar + 1, 4);
 
         messageCRC[4] = 0; // * Thanks to HarmOtten (issue 5)
-        validCRCFound = (strtol(messageCRC, NULL, 16) == currentCRC);
+        if (isxdigit(messageCRC[0]))
+            validCRCFound = (strtol(messageCRC, NULL, 16) == port.currentCRC);
+        else
+            validCRCFound = !p1SerialConfigs[port.config].crc; // DSMR 2.2/3 telegrams end in a bare '!'
 
-#ifdef DEBUG
         if (validCRCFound)
-            Serial.println(F("CRC Valid!"));
+            LOG_DEBUG("P1 port %s: CRC valid", port.topic);
         else
-            Serial.println(F("CRC Invalid!"));
-#endif
-        currentCRC = 0;
+            LOG_WARN("P1 port %s: CRC invalid", port.topic);
+        port.currentCRC = 0;
+        port.crcFailures = validCRCFound ? 0 : port.crcFailures + 1;
+        if (!validCRCFound)
+            port.invalidTelegrams++;
+
+        if (validCRCFound)
+        {
+            p1CommitStaged(port);
+            port.lastValidMillis = millis();
+            port.sequence++;
+            if (&port == &p1Ports[0])
+            {
+                // Only the main meter feeds the derived metrics and grid limits
+                if (port.timestamp != 0)
+                    meterTimestamp = port.timestamp;
+                meterPeakTimestamp = port.peakTimestamp;
+                telegramSequence = port.sequence;
+                telegramStartMicros = port.startMicros;
+                telegramEndMicros = port.endMicros;
+                telegramCommitMicros = micros();
+                computeDerivedMetrics();
+                gridLimitEvaluate();
+                snapshotPublish();
+            }
+        }
     }
     else
     {
-        currentCRC = crc16(currentCRC, (unsigned char *)telegram, len);
+        port.currentCRC = crc16(port.currentCRC, (unsigned char *)telegram, len);
     }
 
-    // Loops throug all the telegramObjects to find the code in the telegram line
-    // If it finds the code the value will be stored in the object so it can later be send to the mqtt broker
-    for (int i = 0; i < NUMBER_OF_READOUTS; i++)
+    if (port.inTelegram)
+        port.telegramLines++;
+
+    // 0-0:1.0.0(210410103019S) = Date-time stamp of the P1 message
+    if (strncmp(telegram, "0-0:1.0.0(", 10) == 0)
     {
-        if (strncmp(telegram, telegramObjects[i].code, strlen(telegramObjects[i].code)) == 0)
-        {
-            long newValue = getValue(telegram, len, telegramObjects[i].startChar, telegramObjects[i].endChar);
-            if (newValue != telegramObjects[i].value)
-            {
-                telegramObjects[i].value = newValue;
-                telegramObjects[i].sendData = true;
-            }
-            break;
+        unsigned long timestamp = meterTimeToEpoch(telegram + 10);
+        if (timestamp)
+            port.timestamp = timestamp;
+    }
 
-#ifdef DEBUG
-            Serial.println((String) "Found a Telegram object: " + telegramObjects[i].name + " value: " + telegramObjects[i].value);
-#endif
-        }
+    // 1-0:1.6.0(200509134558S)(02.589*kW) = Peak demand of the month and when it was reached
+    if (strncmp(telegram, "1-0:1.6.0(", 10) == 0)
+        port.peakTimestamp = meterTimeToEpoch(telegram + 10);
+
+    // Looks up the code in front of the value in the readout table.
+    // If it finds the code the value will be stored in the object so it can later be send to the mqtt broker
+    char *valueStart = (char *)memchr(telegram, '(', len);
+    int i = valueStart ? findReadoutByCode(telegram, valueStart - telegram) : -1;
+    if (i >= 0)
+    {
+        struct TelegramDecodedObject &object = port.objects[i];
+        port.staged[i] = getValue(telegram, len, object.startChar, object.endChar, object.scale);
+        port.stagedFound[i] = true;
+        LOG_DEBUG("Found a Telegram object: %s value: %ld", object.name.c_str(), port.staged[i]);
     }
 
     return validCRCFound;
 }
 
-bool readP1Serial()
+/**
+ *  Copies the parsed values of a telegram with a valid CRC to the readouts.
+ */
+void p1CommitStaged(struct P1Port &port)
 {
-    if (Serial2.available())
+    for (int i = 0; i < numberOfReadouts; i++)
     {
-#ifdef DEBUG
-        Serial.println("Serial2 is available");
-        Serial.println("Memset telegram");
-#endif
-        memset(telegram, 0, sizeof(telegram));
-        while (Serial2.available())
+        struct TelegramDecodedObject &object = port.objects[i];
+        if (port.stagedFound[i] && (port.staged[i] != object.value || object.always))
+            readoutPut(object, port.staged[i]);
+    }
+}
+
+/**
+ *  Moves received bytes into the line buffer, up to and including the next '\n'.
+ *  Returns true when the line is complete.
+ *
+ *  A line that does not fit is longer than any valid line: the telegram is dropped and
+ *  parsing restarts at the last '/' in the line, so a telegram that starts behind the
+ *  garbage is kept.
+ */
+bool p1TakeLine(struct P1Port &port)
+{
+    uint8_t *begin = port.rx + port.rxPosition;
+    int received = port.rxLength - port.rxPosition;
+    uint8_t *newline = (uint8_t *)memchr(begin, '\n', received);
+    int take = newline ? newline - begin + 1 : received;
+
+    int room = P1_MAXLINELENGTH - 1 - port.lineLength;
+    if (take <= room)
+    {
+        memcpy(port.telegram + port.lineLength, begin, take);
+        port.lineLength += take;
+        port.rxPosition += take;
+        return newline != NULL;
+    }
+
+    // The '/' this line started with, at position 0 of the line, does not count
+    int start = findCharInArrayRev((char *)begin, '/', take);
+    if (start > 0 || (start == 0 && port.lineLength > 0))
+    {
+        p1Resync(port);
+        port.discardedBytes += start;
+        port.rxPosition += start;
+        return false;
+    }
+
+    int length = port.lineLength;
+    start = length > 1 ? findCharInArrayRev(port.telegram + 1, '/', length - 1) + 1 : 0;
+    if (start > 0)
+    {
+        port.lineLength = start; // the part in front of the '/' counts as discarded
+        p1Resync(port);
+        memmove(port.telegram, port.telegram + start, length - start);
+        port.lineLength = length - start;
+        port.inTelegram = true;
+        return false;
+    }
+
+    port.lineLength += take;
+    p1Resync(port);
+    port.rxPosition += take;
+    return false;
+}
+
+/**
+ *  Drops the telegram being read and waits for the next '/'.
+ */
+void p1Resync(struct P1Port &port)
+{
+    if (port.inTelegram)
+        port.truncatedTelegrams++;
+    port.discardedBytes += port.lineLength;
+    port.resyncs++;
+    port.inTelegram = false;
+    port.lineLength = 0;
+    port.telegramLines = 0;
+    port.currentCRC = 0;
+}
+
+/**
+ *  Returns the position of the last byte in a line that can not be part of a
+ *  telegram (line noise), or -1 when the line is clean.
+ */
+int p1FindNoise(const char *line, int len)
+{
+    for (int i = len - 1; i >= 0; i--)
+    {
+        unsigned char c = line[i];
+        if ((c < 0x20 && c != '\r' && c != '\n') || c > 0x7e)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ *  Parses what the UART received so far without waiting for more. All parser state
+ *  lives in the port, so a telegram may come in any number of pieces over any number
+ *  of calls. Returns true when a telegram with a valid CRC was committed, the bytes
+ *  after it stay in the port for the next call.
+ *
+ *  Between telegrams, and after line noise or a line that does not fit, the bytes up
+ *  to the next '/' are skipped with a single memchr() per chunk.
+ */
+bool readP1Serial(struct P1Port &port)
+{
+    while (true)
+    {
+        if (port.detecting)
         {
-            // Reads the telegram untill it finds a return character
-            // That is after each line in the telegram
-            int len = Serial2.readBytesUntil('\n', telegram, P1_MAXLINELENGTH);
+            p1DetectStep(port);
+            return false;
+        }
 
-            telegram[len] = '\n';
-            telegram[len + 1] = 0;
+        if (port.rxPosition == port.rxLength)
+        {
+            int available = port.serial->available();
+            if (available <= 0)
+                return false;
 
-            bool result = decodeTelegram(len + 1);
-            // When the CRC is check which is also the end of the telegram
-            // if valid decode return true
-            if (result)
+            if (p1NeedsDetection(port))
             {
-                return true;
+                p1StartDetection(port);
+                return false;
             }
+
+            port.rxLength = port.serial->read(port.rx, available < P1_READ_CHUNK ? available : P1_READ_CHUNK);
+            port.rxPosition = 0;
+        }
+
+        if (!port.inTelegram)
+        {
+            uint8_t *begin = port.rx + port.rxPosition;
+            uint8_t *start = (uint8_t *)memchr(begin, '/', port.rxLength - port.rxPosition);
+            int skipped = start ? start - begin : port.rxLength - port.rxPosition;
+            port.discardedBytes += skipped;
+            port.rxPosition += skipped;
+            if (start == NULL)
+                continue;
+            port.inTelegram = true;
+            port.lineLength = 0;
+        }
+
+        if (!p1TakeLine(port))
+            continue;
+
+        int len = port.lineLength;
+        port.telegram[len] = 0;
+        port.lineLength = 0;
+
+        int noise = p1FindNoise(port.telegram, len);
+        if (noise >= 0)
+        {
+            // Continue with the next telegram when it starts after the noise
+            char *start = (char *)memchr(port.telegram + noise + 1, '/', len - noise - 1);
+            port.lineLength = len;
+            p1Resync(port);
+            if (start == NULL)
+                continue;
+
+            port.discardedBytes -= len - (start - port.telegram);
+            len -= start - port.telegram;
+            memmove(port.telegram, start, len + 1);
+            port.inTelegram = true;
+        }
+
+        repeaterLine(port, len);
+
+        // The CRC line is the end of the telegram
+        if (decodeTelegram(port, len))
+        {
+            repeaterCommit(port);
+            return true;
         }
     }
-    return false;
+}
+
+/**
+ *  True when the telegram just committed on the port is due for publishing, UPDATE_INTERVAL
+ *  after the last published one. Compared on the meter clock, so receive jitter does not
+ *  make a 1 second meter skip every other telegram. Telegrams without a timestamp compare
+ *  millis() with P1_TELEGRAM_JITTER of slack.
+ */
+bool p1PublishDue(struct P1Port &port)
+{
+    long now = millis();
+    bool due;
+    if (port.timestamp != 0 && port.lastUpdateTimestamp != 0)
+        due = (port.timestamp - port.lastUpdateTimestamp) * 1000 >= UPDATE_INTERVAL;
+    else
+        due = port.lastUpdateSent == 0 || now - port.lastUpdateSent + P1_TELEGRAM_JITTER >= UPDATE_INTERVAL;
+
+    if (due)
+    {
+        port.lastUpdateSent = now;
+        port.lastUpdateTimestamp = port.timestamp;
+    }
+    return due;
+}
+
+/**
+ *  Publishes the resynchronisation counters of every port as JSON on <port topic>/parser.
+ */
+void publishParserStats()
+{
+    long now = millis();
+    if (now - LAST_P1_STATS_SENT < P1_STATS_INTERVAL)
+        return;
+    LAST_P1_STATS_SENT = now;
+
+    for (int p = 0; p < P1_PORTS; p++)
+    {
+        struct P1Port &port = p1Ports[p];
+        char topic[64];
+        snprintf(topic, sizeof(topic), "%s/parser", port.topic);
+
+        char payload[128];
+        snprintf(payload, sizeof(payload), "{\"discarded_bytes\":%lu,\"resyncs\":%lu,\"truncated\":%lu,\"invalid\":%lu}",
+                 port.discardedBytes, port.resyncs, port.truncatedTelegrams, port.invalidTelegrams);
+        sendMQTTMessage(topic, payload);
+    }
 }
@@ -0,0 +1,317 @@
+/**
+ *  Runtime readout table.
+ *
+ *  setupDataReadout() holds the default table. A replacement can be sent as text,
+ *  one readout per line:
+ *
+ *      code,name,startChar,endChar,scale,flags,interval
+ *      1-0:1.8.1,consumption_tarif_1,(,*,1000,cl,300000
+ *      ,net_power,(,),1,h,
+ *
+ *  flags: c = counter, a = publish every telegram, h = high and l = low priority.
+ *  interval is the minimum number of milliseconds between publishes, empty or 0 for
+ *  every telegram. Readouts without a code are derived. The text is compiled into a
+ *  compact binary blob that is stored in NVS and loaded at boot, after which the device
+ *  restarts. GET returns the table in use. Version 1 blobs, without intervals and
+ *  priorities, still load.
+ *
+ *      HTTP:  GET/POST /config/readouts (body as text/plain)
+ *      MQTT:  MQTT_READOUT_TABLE_SET_TOPIC, the table in use is published retained on
+ *             MQTT_READOUT_TABLE_TOPIC after connecting
+ *
+ *  Whatever the source, the table ends up in the same hashed lookup, so decoding
+ *  costs the same as with the compiled in table.
+ */
+
+#define READOUT_TABLE_MAX_BLOB (sizeof(ReadoutTableHeader) + NUMBER_OF_READOUTS * sizeof(ReadoutTableEntry))
+
+void setupReadoutTable()
+{
+    setupDataReadout();
+    numberOfReadouts = 0;
+    while (numberOfReadouts < NUMBER_OF_READOUTS && telegramObjects[numberOfReadouts].name.length() > 0)
+    {
+        numberOfReadouts++;
+    }
+
+    static uint8_t blob[READOUT_TABLE_MAX_BLOB];
+    Preferences preferences;
+    preferences.begin(READOUT_TABLE_NAMESPACE, true);
+    size_t length = preferences.getBytesLength(READOUT_TABLE_KEY);
+    if (length > 0 && length <= sizeof(blob))
+    {
+        preferences.getBytes(READOUT_TABLE_KEY, blob, length);
+        if (!readoutTableFromBlob(blob, length))
+        {
+            LOG_WARN("Readout table in NVS is invalid, using the default table");
+        }
+    }
+    preferences.end();
+
+    length = readoutTableToBlob(blob, sizeof(blob));
+    readoutTableCrc = crc16(0x0000, blob, length);
+    buildReadoutLookup();
+
+    LOG_INFO("MQTT Topics initialized: %d readouts", numberOfReadouts);
+    for (int i = 0; i < numberOfReadouts; i++)
+    {
+        LOG_DEBUG("%s/%s", MQTT_ROOT_TOPIC, telegramObjects[i].name.c_str());
+    }
+}
+
+void setupReadoutTableApi()
+{
+    httpServer.on("/config/readouts", HTTP_GET, []() {
+        String table;
+        readoutTableFormat(table);
+        httpServer.send(200, "text/plain", table);
+    });
+    httpServer.on("/config/readouts", HTTP_POST, []() {
+        if (storeReadoutTable(httpServer.arg("plain").c_str()))
+            httpServer.send(200, "text/plain", "Stored, restarting");
+        else
+            httpServer.send(400, "text/plain", "Invalid readout table");
+        restartWhenStored();
+    });
+}
+
+unsigned int readoutHash(const char *code, int length)
+{
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < length; i++)
+    {
+        hash = (hash ^ (uint8_t)code[i]) * 16777619u;
+    }
+    return hash;
+}
+
+void buildReadoutLookup()
+{
+    memset(readoutLookup, -1, sizeof(readoutLookup));
+    for (int i = 0; i < numberOfReadouts; i++)
+    {
+        int length = strlen(telegramObjects[i].code);
+        if (length == 0)
+            continue;
+
+        unsigned int slot = readoutHash(telegramObjects[i].code, length) & (READOUT_LOOKUP_SIZE - 1);
+        while (readoutLookup[slot] >= 0)
+        {
+            slot = (slot + 1) & (READOUT_LOOKUP_SIZE - 1);
+        }
+        readoutLookup[slot] = i;
+    }
+}
+
+/**
+ *  Returns the index of the readout with exactly this code, or -1.
+ */
+int findReadoutByCode(const char *code, int length)
+{
+    unsigned int slot = readoutHash(code, length) & (READOUT_LOOKUP_SIZE - 1);
+    while (readoutLookup[slot] >= 0)
+    {
+        const char *candidate = telegramObjects[readoutLookup[slot]].code;
+        if (strncmp(candidate, code, length) == 0 && candidate[length] == 0)
+            return readoutLookup[slot];
+        slot = (slot + 1) & (READOUT_LOOKUP_SIZE - 1);
+    }
+    return -1;
+}
+
+int readoutTableToBlob(uint8_t *blob, int size)
+{
+    struct ReadoutTableHeader header = {READOUT_TABLE_MAGIC, READOUT_TABLE_VERSION, (uint8_t)numberOfReadouts};
+    memcpy(blob, &header, sizeof(header));
+    int length = sizeof(header);
+
+    for (int i = 0; i < numberOfReadouts && length + (int)sizeof(ReadoutTableEntry) <= size; i++)
+    {
+        struct ReadoutTableEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        strncpy(entry.code, telegramObjects[i].code, sizeof(entry.code) - 1);
+        strncpy(entry.name, telegramObjects[i].name.c_str(), sizeof(entry.name) - 1);
+        entry.startChar = telegramObjects[i].startChar;
+        entry.endChar = telegramObjects[i].endChar;
+        entry.flags = (telegramObjects[i].counter ? READOUT_FLAG_COUNTER : 0) | (telegramObjects[i].always ? READOUT_FLAG_ALWAYS : 0) |
+                      (telegramObjects[i].priority == READOUT_PRIORITY_HIGH ? READOUT_FLAG_HIGH : 0) |
+                      (telegramObjects[i].priority == READOUT_PRIORITY_LOW ? READOUT_FLAG_LOW : 0);
+        entry.scale = telegramObjects[i].scale;
+        entry.interval = telegramObjects[i].interval;
+        memcpy(blob + length, &entry, sizeof(entry));
+        length += sizeof(entry);
+    }
+    return length;
+}
+
+bool readoutTableFromBlob(const uint8_t *blob, int length)
+{
+    struct ReadoutTableHeader header;
+    if (length < (int)sizeof(header))
+        return false;
+    memcpy(&header, blob, sizeof(header));
+    int entrySize = header.version == 1 ? READOUT_TABLE_V1_ENTRY_SIZE : sizeof(ReadoutTableEntry);
+    if (header.magic != READOUT_TABLE_MAGIC || header.version < 1 || header.version > READOUT_TABLE_VERSION ||
+        header.count == 0 || header.count > NUMBER_OF_READOUTS || length != (int)sizeof(header) + header.count * entrySize)
+        return false;
+
+    for (int i = 0; i < NUMBER_OF_READOUTS; i++)
+    {
+        struct ReadoutTableEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        if (i < header.count)
+            memcpy(&entry, blob + sizeof(header) + i * entrySize, entrySize);
+        entry.code[sizeof(entry.code) - 1] = 0;
+        entry.name[sizeof(entry.name) - 1] = 0;
+
+        telegramObjects[i].name = entry.name;
+        strcpy(telegramObjects[i].code, entry.code);
+        telegramObjects[i].startChar = i < header.count ? entry.startChar : '(';
+        telegramObjects[i].endChar = i < header.count ? entry.endChar : ')';
+        telegramObjects[i].scale = i < header.count ? entry.scale : 1000;
+        telegramObjects[i].counter = entry.flags & READOUT_FLAG_COUNTER;
+        telegramObjects[i].always = entry.flags & READOUT_FLAG_ALWAYS;
+        telegramObjects[i].interval = entry.interval;
+        telegramObjects[i].priority = entry.flags & READOUT_FLAG_HIGH  ? READOUT_PRIORITY_HIGH
+                                      : entry.flags & READOUT_FLAG_LOW ? READOUT_PRIORITY_LOW
+                                                                       : READOUT_PRIORITY_NORMAL;
+        telegramObjects[i].value = 0;
+        telegramObjects[i].sendData = true;
+    }
+    numberOfReadouts = header.count;
+    return true;
+}
+
+/**
+ *  Copies the next comma separated field of line into field, returns the rest of the line.
+ */
+const char *readoutTableField(const char *line, char *field, int size)
+{
+    int length = 0;
+    while (*line && *line != ',' && *line != '\n' && *line != '\r')
+    {
+        if (length < size - 1)
+            field[length++] = *line;
+        line++;
+    }
+    field[length] = 0;
+    return *line == ',' ? line + 1 : line;
+}
+
+/**
+ *  Compiles the text format into a blob, returns its length or -1 when the text is invalid.
+ */
+int readoutTableParse(const char *text, uint8_t *blob, int size)
+{
+    struct ReadoutTableHeader header = {READOUT_TABLE_MAGIC, READOUT_TABLE_VERSION, 0};
+    int length = sizeof(header);
+
+    while (*text)
+    {
+        if (*text == '\n' || *text == '\r')
+        {
+            text++;
+            continue;
+        }
+        if (header.count == NUMBER_OF_READOUTS || length + (int)sizeof(ReadoutTableEntry) > size)
+            return -1;
+
+        struct ReadoutTableEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        char startChar[2], endChar[2], scale[12], flags[8], interval[12];
+        text = readoutTableField(text, entry.code, sizeof(entry.code));
+        text = readoutTableField(text, entry.name, sizeof(entry.name));
+        text = readoutTableField(text, startChar, sizeof(startChar));
+        text = readoutTableField(text, endChar, sizeof(endChar));
+        text = readoutTableField(text, scale, sizeof(scale));
+        text = readoutTableField(text, flags, sizeof(flags));
+        text = readoutTableField(text, interval, sizeof(interval));
+        while (*text && *text != '\n')
+            text++;
+
+        if (entry.name[0] == 0 || startChar[0] == 0 || endChar[0] == 0)
+            return -1;
+        entry.startChar = startChar[0];
+        entry.endChar = endChar[0];
+        entry.scale = scale[0] ? atol(scale) : 1000;
+        entry.flags = (strchr(flags, 'c') ? READOUT_FLAG_COUNTER : 0) | (strchr(flags, 'a') ? READOUT_FLAG_ALWAYS : 0) |
+                      (strchr(flags, 'h') ? READOUT_FLAG_HIGH : 0) | (strchr(flags, 'l') ? READOUT_FLAG_LOW : 0);
+        entry.interval = strtoul(interval, NULL, 10);
+        if ((entry.flags & READOUT_FLAG_HIGH) && (entry.flags & READOUT_FLAG_LOW))
+            return -1;
+
+        memcpy(blob + length, &entry, sizeof(entry));
+        length += sizeof(entry);
+        header.count++;
+    }
+
+    if (header.count == 0)
+        return -1;
+    memcpy(blob, &header, sizeof(header));
+    return length;
+}
+
+void readoutTableFormat(String &table)
+{
+    for (int i = 0; i < numberOfReadouts; i++)
+    {
+        char line[112];
+        snprintf(line, sizeof(line), "%s,%s,%c,%c,%ld,%s%s%s,%lu\n", telegramObjects[i].code, telegramObjects[i].name.c_str(),
+                 telegramObjects[i].startChar, telegramObjects[i].endChar, telegramObjects[i].scale,
+                 telegramObjects[i].counter ? "c" : "", telegramObjects[i].always ? "a" : "",
+                 telegramObjects[i].priority == READOUT_PRIORITY_HIGH  ? "h"
+                 : telegramObjects[i].priority == READOUT_PRIORITY_LOW ? "l"
+                                                                       : "",
+                 telegramObjects[i].interval);
+        table += line;
+    }
+}
+
+/**
+ *  Validates and stores a new table in NVS, it is used after the restart.
+ */
+bool storeReadoutTable(const char *text)
+{
+    static uint8_t blob[READOUT_TABLE_MAX_BLOB];
+    int length = readoutTableParse(text, blob, sizeof(blob));
+    if (length < 0)
+        return false;
+
+    Preferences preferences;
+    preferences.begin(READOUT_TABLE_NAMESPACE, false);
+    readoutTableStored = preferences.putBytes(READOUT_TABLE_KEY, blob, length) == (size_t)length;
+    preferences.end();
+    return readoutTableStored;
+}
+
+void restartWhenStored()
+{
+    if (!readoutTableStored)
+        return;
+
+    LOG_INFO("New readout table stored, restarting");
+    outboxFlush();
+    logFlush();
+    delay(500);
+    ESP.restart();
+}
+
+void handleReadoutTableRequest(const uint8_t *payload, unsigned int length)
+{
+    static char text[NUMBER_OF_READOUTS * 80];
+    if (length >= sizeof(text))
+        return;
+    memcpy(text, payload, length);
+    text[length] = 0;
+
+    storeReadoutTable(text);
+    restartWhenStored();
+}
+
+void publishReadoutTable()
+{
+    String table;
+    readoutTableFormat(table);
+    mqttClient.publish(MQTT_READOUT_TABLE_TOPIC, table.c_str(), true);
+}
@@ -0,0 +1,55 @@
+/**
+ *  P1 repeater.
+ *
+ *  Every line read from a port is written to the TX pin of the same UART. The
+ *  write only copies into the UART driver's TX ring buffer, the FIFO and its
+ *  interrupt do the rest, so the parser never waits on it. Forwarding happens per
+ *  line, the added latency is at most one line.
+ *  With P1_REPEATER_CRC_ONLY a telegram is collected and only sent when its CRC is
+ *  valid, the added latency is then one telegram.
+ */
+
+/**
+ *  Sets the line inversion of a port's UART, RX stays inverted for the meter.
+ *  Call right after begin().
+ */
+void setupRepeater(uart_port_t uart)
+{
+#ifdef P1_REPEATER
+    uart_set_line_inverse(uart, UART_SIGNAL_RXD_INV | (P1_REPEATER_INVERT ? UART_SIGNAL_TXD_INV : 0));
+#endif
+}
+
+/**
+ *  Called for every line read from a port, including its line end.
+ */
+void repeaterLine(struct P1Port &port, int len)
+{
+#if defined(P1_REPEATER) && defined(P1_REPEATER_CRC_ONLY)
+    if (port.telegram[0] == '/')
+        port.repeatLength = 0;
+
+    // Too long for a telegram, it will never be forwarded
+    if (port.repeatLength + len > P1_REPEATER_BUFFER)
+    {
+        port.repeatLength = P1_REPEATER_BUFFER + 1;
+        return;
+    }
+    memcpy(port.repeatBuffer + port.repeatLength, port.telegram, len);
+    port.repeatLength += len;
+#elif defined(P1_REPEATER)
+    port.serial->write((const uint8_t *)port.telegram, len);
+#endif
+}
+
+/**
+ *  Called when a telegram with a valid CRC is complete.
+ */
+void repeaterCommit(struct P1Port &port)
+{
+#if defined(P1_REPEATER) && defined(P1_REPEATER_CRC_ONLY)
+    if (port.repeatLength <= P1_REPEATER_BUFFER)
+        port.serial->write((const uint8_t *)port.repeatBuffer, port.repeatLength);
+    port.repeatLength = 0;
+#endif
+}
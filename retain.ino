@@ -0,0 +1,107 @@
+/**
+ *  Last committed state over a restart.
+ *
+ *  After every processed telegram the readout values, sequence numbers and the
+ *  capacity, energy and rollup state in progress are copied to RTC memory, which
+ *  keeps its contents over ESP.restart(), a watchdog reset and an OTA update. On a
+ *  warm boot they are restored before the first telegram, so change detection
+ *  carries on and the first telegram only publishes what actually changed, or was
+ *  not published yet before the restart. The copy is ignored after a power cycle,
+ *  when its layout changed or when it belongs to another readout table.
+ */
+
+#define RETAIN_MAGIC 0x50315253 // "P1RS"
+
+unsigned int retainedCrc()
+{
+    return crc16(0x0000, (unsigned char *)&retainedState, offsetof(struct RetainedState, crc));
+}
+
+void retainSave()
+{
+    retainedState.magic = RETAIN_MAGIC;
+    retainedState.size = sizeof(RetainedState);
+    retainedState.tableCrc = readoutTableCrc;
+    for (int p = 0; p < P1_PORTS; p++)
+    {
+        for (int i = 0; i < numberOfReadouts; i++)
+        {
+            retainedState.values[p][i] = p1Ports[p].objects[i].value;
+            retainedState.pending[p][i] = p1Ports[p].objects[i].sendData;
+        }
+        retainedState.sequences[p] = p1Ports[p].sequence;
+    }
+    retainedState.meterTimestamp = meterTimestamp;
+
+    retainedState.capacityQuarter = capacityQuarter;
+    memcpy(retainedState.capacityMonths, capacityMonths, sizeof(capacityMonths));
+
+    for (unsigned int e = 0; e < ENERGY_INTEGRATORS; e++)
+    {
+        retainedState.energy[e].anchor = energyIntegrators[e].anchor;
+        retainedState.energy[e].integrated = energyIntegrators[e].integrated;
+        retainedState.energy[e].lastPower = energyIntegrators[e].lastPower;
+    }
+    retainedState.energyLastTimestamp = energyLastTimestamp;
+
+    for (int t = 0; t < ROLLUP_TIERS; t++)
+    {
+        retainedState.rollups[t].current = rollupTiers[t].current;
+        memcpy(retainedState.rollups[t].sum, rollupTiers[t].sum, sizeof(rollupTiers[t].sum));
+    }
+
+    retainedState.crc = retainedCrc();
+}
+
+/**
+ *  Restores the retained state, call it at the end of setup(). Returns false when there
+ *  is nothing valid to restore.
+ */
+bool restoreRetainedState()
+{
+    if (esp_reset_reason() == ESP_RST_POWERON || retainedState.magic != RETAIN_MAGIC ||
+        retainedState.size != sizeof(RetainedState) || retainedState.tableCrc != readoutTableCrc ||
+        retainedState.crc != retainedCrc())
+    {
+        LOG_INFO("No retained state, starting fresh");
+        return false;
+    }
+
+    for (int p = 0; p < P1_PORTS; p++)
+    {
+        for (int i = 0; i < numberOfReadouts; i++)
+        {
+            p1Ports[p].objects[i].value = retainedState.values[p][i];
+            p1Ports[p].objects[i].sendData = retainedState.pending[p][i];
+        }
+        p1Ports[p].sequence = retainedState.sequences[p];
+    }
+    meterTimestamp = retainedState.meterTimestamp;
+    telegramSequence = p1Ports[0].sequence;
+
+    capacityQuarter = retainedState.capacityQuarter;
+    memcpy(capacityMonths, retainedState.capacityMonths, sizeof(capacityMonths));
+
+    for (unsigned int e = 0; e < ENERGY_INTEGRATORS; e++)
+    {
+        energyIntegrators[e].anchor = retainedState.energy[e].anchor;
+        energyIntegrators[e].integrated = retainedState.energy[e].integrated;
+        energyIntegrators[e].lastPower = retainedState.energy[e].lastPower;
+    }
+    energyLastTimestamp = retainedState.energyLastTimestamp;
+
+    for (int t = 0; t < ROLLUP_TIERS; t++)
+    {
+        rollupTiers[t].current = retainedState.rollups[t].current;
+        memcpy(rollupTiers[t].sum, retainedState.rollups[t].sum, sizeof(rollupTiers[t].sum));
+    }
+
+    // Pollers get the last known values before the first telegram
+    computeDerivedMetrics();
+    snapshotPublish();
+    modbusUpdateRegisters();
+    emulationUpdate();
+
+    LOG_INFO("Retained state restored, telegram %lu", telegramSequence);
+    return true;
+}
@@ -0,0 +1,142 @@
+/**
+ *  Rollup tiers (1 minute, 15 minutes, 1 hour).
+ *
+ *  Every tier has a ring of closed intervals and one interval in progress. Each
+ *  committed telegram only updates the intervals in progress, an interval is closed
+ *  and copied into the ring when the first telegram of the next interval arrives.
+ *  Reading a tier never touches the raw history.
+ */
+
+void setupRollupTier(int tier, unsigned long seconds, const char *name, int capacity)
+{
+    if (!psramFound())
+        capacity /= ROLLUP_SLOTS_NO_PSRAM_DIVIDER;
+
+    rollupTiers[tier].seconds = seconds;
+    rollupTiers[tier].name = name;
+    rollupTiers[tier].first = 0;
+    rollupTiers[tier].used = 0;
+    rollupTiers[tier].current.count = 0;
+    if (psramFound())
+        rollupTiers[tier].buckets = (struct RollupBucket *)ps_malloc(capacity * sizeof(RollupBucket));
+    else
+        rollupTiers[tier].buckets = (struct RollupBucket *)malloc(capacity * sizeof(RollupBucket));
+    rollupTiers[tier].capacity = rollupTiers[tier].buckets != NULL ? capacity : 0;
+
+    LOG_INFO("Rollup %s: %d slots", name, rollupTiers[tier].capacity);
+}
+
+void setupRollups()
+{
+    setupRollupTier(0, 60, "1m", ROLLUP_SLOTS_1M);
+    setupRollupTier(1, 900, "15m", ROLLUP_SLOTS_15M);
+    setupRollupTier(2, 3600, "1h", ROLLUP_SLOTS_1H);
+}
+
+/**
+ *  Returns the tier index for a name like "15m", or -1.
+ */
+int rollupTierByName(const char *name)
+{
+    for (int tier = 0; tier < ROLLUP_TIERS; tier++)
+    {
+        if (strcmp(rollupTiers[tier].name, name) == 0)
+            return tier;
+    }
+    return -1;
+}
+
+/**
+ *  Closed interval number n of a tier, 0 is the oldest.
+ */
+struct RollupBucket *rollupBucketAt(int tier, int n)
+{
+    struct RollupTier &rollup = rollupTiers[tier];
+    return &rollup.buckets[(rollup.first + n) % rollup.capacity];
+}
+
+/**
+ *  Index of the first closed interval that ends after timestamp, intervals are
+ *  sorted on start time so this is a binary search. Returns used when there is none.
+ */
+int rollupFind(int tier, unsigned long timestamp)
+{
+    int low = 0;
+    int high = rollupTiers[tier].used;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (rollupBucketAt(tier, mid)->start + rollupTiers[tier].seconds <= timestamp)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+void rollupClose(struct RollupTier &rollup)
+{
+    for (int i = 0; i < numberOfReadouts; i++)
+    {
+        rollup.current.mean[i] = rollup.sum[i] / rollup.current.count;
+    }
+
+    if (rollup.capacity == 0)
+        return;
+
+    if (rollup.used < rollup.capacity)
+        rollup.used++;
+    else
+        rollup.first = (rollup.first + 1) % rollup.capacity;
+
+    rollup.buckets[(rollup.first + rollup.used - 1) % rollup.capacity] = rollup.current;
+}
+
+/**
+ *  Adds a telegram to the intervals in progress of all tiers.
+ */
+void rollupUpdate(unsigned long timestamp, const long values[])
+{
+    for (int tier = 0; tier < ROLLUP_TIERS; tier++)
+    {
+        struct RollupTier &rollup = rollupTiers[tier];
+        unsigned long start = timestamp - timestamp % rollup.seconds;
+
+        if (rollup.current.count > 0 && rollup.current.start != start)
+        {
+            rollupClose(rollup);
+            rollup.current.count = 0;
+        }
+
+        if (rollup.current.count == 0)
+        {
+            rollup.current.start = start;
+            for (int i = 0; i < numberOfReadouts; i++)
+            {
+                rollup.current.min[i] = values[i];
+                rollup.current.max[i] = values[i];
+                rollup.sum[i] = 0;
+            }
+        }
+
+        for (int i = 0; i < numberOfReadouts; i++)
+        {
+            if (values[i] < rollup.current.min[i])
+                rollup.current.min[i] = values[i];
+            if (values[i] > rollup.current.max[i])
+                rollup.current.max[i] = values[i];
+            rollup.sum[i] += values[i];
+        }
+        rollup.current.count++;
+    }
+}
+
+void rollupUpdateTelegram()
+{
+    long values[NUMBER_OF_READOUTS];
+    for (int i = 0; i < numberOfReadouts; i++)
+    {
+        values[i] = telegramObjects[i].value;
+    }
+    rollupUpdate(meterTimestamp, values);
+}
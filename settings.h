@@ -1,10 +1,30 @@
-#define DEBUG
-// Update treshold in milliseconds, messages will only be sent on this interval
+// Logging, see logger.h. Messages up to LOG_LEVEL are kept in a RAM ring and written to
+// the enabled outputs from loop(), so logging never waits for a slow console.
+#define LOG_LEVEL LOG_LEVEL_INFO // LOG_LEVEL_NONE, _ERROR, _WARN, _INFO or _DEBUG
+#define LOG_RING_SIZE 128        // messages, a power of two
+#define LOG_MAX_ARGS 4
+#define LOG_TO_SERIAL
+//#define LOG_TELNET_PORT 23 // serves the log to one telnet client
+//#define MQTT_LOG_TOPIC MQTT_ROOT_TOPIC "/log"
+
+// Update treshold in milliseconds, telegrams are published at most on this interval. Every
+// telegram is still stored (history, rollups, outbox). Readouts can be published less
+// often, see the interval and priority of each readout in setupDataReadout().
 #define UPDATE_INTERVAL 1000 // 1 second
 //#define UPDATE_INTERVAL 10000 // 10 seconds
 //#define UPDATE_INTERVAL 60000  // 1 minute
 //#define UPDATE_INTERVAL 300000 // 5 minutes
 
+// Publish scheduling. Of the pending readouts that are due, the high priority ones are
+// published first. When a publish fails or the readouts of a telegram take longer than
+// MQTT_PUBLISH_BUDGET microseconds the link is congested, the rest stays pending for
+// the next telegram.
+#define MQTT_PUBLISH_BUDGET 50000
+#define P1_TELEGRAM_JITTER 250 // milliseconds, for telegrams without a meter timestamp
+#define READOUT_PRIORITY_HIGH 0
+#define READOUT_PRIORITY_NORMAL 1
+#define READOUT_PRIORITY_LOW 2
+
 // Update treshold in milliseconds,
 // this will also send values that are more than the tresholds time the same
 #define UPDATE_FULL_INTERVAL 600000 // 10 minutes
@@ -14,19 +34,198 @@
 #define HOSTNAME "p1meter"
 #define OTA_PASSWORD "admin"
 
+// Fast boot. The access point (BSSID and channel) of the last connection is kept in RTC
+// memory, so after a restart WiFi connects without scanning. The P1 ports are read from
+// the start, telegrams received before the broker is reachable go to the outbox.
+#define WIFI_CONNECT_TIMEOUT 10000 // milliseconds before a connect attempt is retried, with a full scan
+// Uncomment to skip DHCP
+//#define STATIC_IP 192, 168, 1, 50
+#define STATIC_GATEWAY 192, 168, 1, 1
+#define STATIC_SUBNET 255, 255, 255, 0
+#define STATIC_DNS 192, 168, 1, 1
+#define MQTT_BOOT_TOPIC MQTT_ROOT_TOPIC "/boot" // boot timings, published once per boot
+
 #define BAUD_RATE 115200
 #define RXD2 16
 #define TXD2 17
 #define P1_MAXLINELENGTH 1050
+#define P1_RX_BUFFER_SIZE 2048 // UART driver buffer per port, holds two telegrams
+#define P1_READ_CHUNK 256      // bytes taken from the UART driver at a time
+#define P1_STATS_INTERVAL 60000 // parser counters are published on <port topic>/parser every minute
+
+// Serial settings of the P1 port, detected at startup and stored in NVS so later boots
+// start straight on the known settings. DSMR 4/5 meters send at 115200 8N1 with a CRC,
+// DSMR 2.2/3 meters at 9600 7E1 without one, every 10 seconds.
+#define P1_CONFIG_KEY "p1config"      // NVS key prefix in READOUT_TABLE_NAMESPACE, one key per port
+#define P1_DETECT_CRC_FAILURES 10     // invalid telegrams in a row that start a new detection
+#define P1_DETECT_SILENCE 60000       // milliseconds with data but no valid telegram that start a new detection
+
+// Second P1 port on UART1, for a sub-meter (PV, heat pump). Each port has its own parser
+// state and readout values, the second meter publishes under MQTT_PORT2_ROOT_TOPIC.
+// The history, outbox, Modbus and HTTP APIs and the derived readouts follow the main
+// meter on UART2. The pins are not used by any other feature.
+//#define P1_SECOND_PORT
+#define RXD1 32
+#define TXD1 33
+#define MQTT_PORT2_ROOT_TOPIC "sensors/power/p1meter2"
+
+// P1 repeater: forwards what is received on a port out of its TX pin (TXD2, TXD1),
+// so a second P1 consumer (charger, vendor dongle) can share the port.
+// P1_REPEATER_CRC_ONLY, together with P1_REPEATER, holds every telegram back until its CRC checks out.
+//#define P1_REPEATER
+//#define P1_REPEATER_CRC_ONLY
+#define P1_REPEATER_INVERT true // P1 uses inverted logic, false for a plain UART consumer
+#define P1_REPEATER_BUFFER 2048
+#if defined(P1_REPEATER_CRC_ONLY) && !defined(P1_REPEATER)
+#error "P1_REPEATER_CRC_ONLY needs P1_REPEATER, which sets up the TX pin"
+#endif
+
+#ifdef P1_SECOND_PORT
+#define P1_PORTS 2
+#else
+#define P1_PORTS 1
+#endif
+
+// loop() sleeps until a P1 port receives data or WiFi changes state, and polls the
+// network services (MQTT, HTTP, Modbus, OTA) at least every LOOP_IDLE_WAIT milliseconds
+#define LOOP_IDLE_WAIT 20
+#define LOOP_EVENT_P1 (1 << 0)
+#define LOOP_EVENT_WIFI (1 << 1)
+#define LOOP_EVENTS (LOOP_EVENT_P1 | LOOP_EVENT_WIFI)
+
+// Meter powered operation, for an ESP32 fed from P1 pin 1 (DSMR 5 allows 250 mA at 5 V).
+// Lowers the CPU clock, lets WiFi sleep between DTIM beacons and, when the core is built
+// with CONFIG_PM_ENABLE, light-sleeps between telegrams. Every POWER_REPORT_INTERVAL the
+// awake duty cycle and the average current estimated from it are published on MQTT_POWER_TOPIC.
+//#define POWER_SAVE
+#define POWER_CPU_MHZ 80
+#define POWER_WAKE_AHEAD 100 // milliseconds before the next expected telegram light sleep is blocked
+#define POWER_BUDGET_MA 250
+#define POWER_ACTIVE_MA 45 // CPU running at POWER_CPU_MHZ
+#define POWER_IDLE_MA 20   // CPU idle, clock gated
+#define POWER_SLEEP_MA 2   // light sleep
+#define POWER_WIFI_MA 30   // average of WiFi in modem sleep
+#define POWER_REPORT_INTERVAL 60000
+#define MQTT_POWER_TOPIC MQTT_ROOT_TOPIC "/power"
 
 #define MQTT_MAX_RECONNECT_TRIES 100
 #define MQTT_ROOT_TOPIC "sensors/power/p1meter"
+#define MQTT_BUFFER_SIZE 1536
+
+// Store-and-forward outbox. Telegrams committed while the broker is unreachable
+// are kept in RAM, spilled in batches to a ring file on LittleFS when RAM fills up
+// and replayed in order (with their meter timestamp) once the broker is back.
+#define OUTBOX_RAM_SLOTS 32
+#define OUTBOX_SPILL_BATCH 16
+#define OUTBOX_FLASH_SLOTS 8192 // ~2 hours of 1 second telegrams
+#define OUTBOX_FLASH_FILE "/outbox.bin"
+#define OUTBOX_STATE_FILE "/outbox.idx"
+#define OUTBOX_REPLAY_INTERVAL 100  // milliseconds between two replayed telegrams
+#define OUTBOX_REPLAY_HOLDOFF 10000 // random delay before replay starts, spreads a reconnecting fleet
+// A replayed telegram as JSON: per readout ,"<name>":<up to 11 digits> plus ts and seq
+#define OUTBOX_JSON_SIZE (NUMBER_OF_READOUTS * (READOUT_NAME_SIZE + 16) + 48)
+#define MQTT_BACKLOG_TOPIC MQTT_ROOT_TOPIC "/backlog"
+
+// The readout table can be replaced at runtime, it is stored in NVS and used instead of
+// setupDataReadout() on the next boot. See setupReadoutTable() for the format.
+#define READOUT_TABLE_NAMESPACE "p1meter"
+#define READOUT_TABLE_KEY "readouts"
+#define READOUT_LOOKUP_SIZE 64 // hash slots, power of two and at least twice NUMBER_OF_READOUTS
+#define MQTT_READOUT_TABLE_TOPIC MQTT_ROOT_TOPIC "/config/readouts"
+#define MQTT_READOUT_TABLE_SET_TOPIC MQTT_READOUT_TABLE_TOPIC "/set"
+
+// On-device history of every telegram. Samples are compressed with delta(-of-delta)
+// encoding into fixed size blocks, the oldest block is reused when all are full.
+// ~22 bytes per telegram with the default readouts (test/bench_history), so 496 blocks
+// (2 MB of PSRAM) hold a bit more than 24 hours at 1 second.
+#define HISTORY_BLOCK_SIZE 4096
+#define HISTORY_BLOCKS 496
+#define HISTORY_BLOCKS_NO_PSRAM 16
+
+// Rollup tiers next to the raw history, updated on every telegram.
+// Slots per tier: a day of 1 minute, two weeks of 15 minute and a month of 1 hour rollups.
+#define ROLLUP_TIERS 3
+#define ROLLUP_SLOTS_1M 1440
+#define ROLLUP_SLOTS_15M 1344
+#define ROLLUP_SLOTS_1H 744
+#define ROLLUP_SLOTS_NO_PSRAM_DIVIDER 24
+
+// Range queries over the history, over HTTP (GET /history) and MQTT (request/response)
+#define HTTP_PORT 80
+#define QUERY_CHUNK_SIZE 512
+// Longest CSV row, the header of a tier query over every readout: three columns of up to
+// 6 characters of suffix, a comma and the name per readout. A data row has at most
+// three numbers of 12 characters per readout.
+#define QUERY_ROW_SIZE (3 * (READOUT_NAME_SIZE + 7) * NUMBER_OF_READOUTS + 32)
+// A query holds loop() until its response is sent, so it is cut into pages: the UART buffer of
+// the P1 port holds about 2 seconds of telegrams.
+#define QUERY_MAX_ROWS 500
+#define QUERY_TIME_BUDGET 100
+#define MQTT_HISTORY_REQUEST_TOPIC MQTT_ROOT_TOPIC "/history/request"
+#define MQTT_HISTORY_RESPONSE_TOPIC MQTT_ROOT_TOPIC "/history/response"
+
+// Modbus TCP server for battery inverters and EV chargers.
+// Input registers follow the Eastron SDM630 layout (float32, high word first),
+// holding register 2*n holds readout n as int32 in the units of its MQTT topic.
+#define MODBUS_PORT 502
+#define MODBUS_MAX_CLIENTS 4
+#define MODBUS_INPUT_REGISTERS 0x4C
+#define MODBUS_FRAME_SIZE 260 // MBAP header and the largest PDU
+// The telegram has no grid frequency, input register 0x46 reads 0. Only for inverters that
+// refuse to work without one: answers this fixed value, which is not a measurement.
+//#define MODBUS_NOMINAL_FREQUENCY 50.0
+
+// Emulation of the HomeWizard P1 (/api, /api/v1/data) and Shelly 3EM (/status, /emeter/<n>)
+// HTTP APIs, for home batteries and energy management systems that only know those meters
+#define EMULATION_FIRMWARE_VERSION "5.18"
+
+// Grid limit triggers (capacity tariff, main fuse protection), see gridLimitRules below
+#define MQTT_GRID_LIMIT_TOPIC MQTT_ROOT_TOPIC "/grid_limit"
 
-#define NUMBER_OF_READOUTS 19
+// Belgian capacity tariff: quarter hour average demand, its projection and the monthly peaks
+#define CAPACITY_QUARTER 900
+#define CAPACITY_MONTHS 13
+#define CAPACITY_MINIMUM_PEAK 2500 // W, Fluvius charges at least 2.5 kW
+#define MQTT_CAPACITY_TOPIC MQTT_ROOT_TOPIC "/capacity"
 
-long LAST_RECONNECT_ATTEMPT = 0;
-long LAST_UPDATE_SENT = 0;
+// Energy registers with mWh resolution, integrated from the actual power between two
+// steps of the official registers. Published in Wh with 3 decimals on MQTT_ENERGY_TOPIC/<name>.
+#define ENERGY_PUBLISH_INTERVAL 10000 // 10 seconds
+#define MQTT_ENERGY_TOPIC MQTT_ROOT_TOPIC "/energy"
+
+// Latency of the main meter's telegrams, from their '/' to their last MQTT publish written
+// to the socket. Log2 histograms per stage are published as JSON on MQTT_LATENCY_TOPIC
+// every LATENCY_PUBLISH_INTERVAL and then cleared.
+#define LATENCY_PUBLISH_INTERVAL 60000 // 1 minute
+#define LATENCY_BUCKETS 24             // bucket n counts latencies below 2^n microseconds
+#define MQTT_LATENCY_TOPIC MQTT_ROOT_TOPIC "/latency"
+// Also publish the stage latencies of every telegram on MQTT_LATENCY_TOPIC/trace
+//#define LATENCY_TRACE
+
+// Maximum number of readouts, the table itself is set up by setupReadoutTable()
+#define NUMBER_OF_READOUTS 32
+#define READOUT_NAME_SIZE 32 // including the terminating 0
+
+EventGroupHandle_t loopEvents; // LOOP_EVENT_* bits, set by the UART and WiFi callbacks
+#ifdef POWER_SAVE
+esp_pm_lock_handle_t powerLock = NULL; // held while light sleep would lose telegram bytes
+bool powerLightSleep = false;          // automatic light sleep is configured
+bool powerAwake = false;               // powerLock is held
+uint64_t powerIdleMicros = 0;          // waited in loopWait() while awake
+uint64_t powerSleepMicros = 0;         // waited in loopWait() with light sleep allowed
+long LAST_POWER_REPORT = 0;
+#endif
+long LAST_RECONNECT_ATTEMPT = -5000; // the first attempt is not held back
 long LAST_FULL_UPDATE_SENT = 0;
+long LAST_OUTBOX_REPLAY = 0;
+long LAST_ENERGY_SENT = 0;
+long LAST_LATENCY_SENT = 0;
+long LAST_PUBLISH_STATS_SENT = 0;
+unsigned long deferredPublishes = 0;  // due readouts left pending on a congested link
+unsigned long coalescedPublishes = 0; // pending values replaced by a newer one before they were published
+long LAST_P1_STATS_SENT = 0;
+int MQTT_RECONNECT_RETRIES = 0;
+long LAST_WIFI_ATTEMPT = 0;
 
 char WIFI_SSID[32] = "";
 char WIFI_PASS[32] = "";
@@ -36,8 +235,6 @@ char MQTT_PORT[6] = "";
 char MQTT_USER[32] = "";
 char MQTT_PASS[32] = "";
 
-char telegram[P1_MAXLINELENGTH];
-
 struct TelegramDecodedObject
 {
   String name;
@@ -45,9 +242,484 @@ struct TelegramDecodedObject
   char code[16];
   char startChar = '(';
   char endChar = ')';
+  long scale = 1000;    // multiplier for values ending in '*' (e.g. kWh to Wh)
+  bool counter = false; // cumulative register, only goes up
+  bool always = false;  // publish every telegram instead of only on change
+  unsigned long interval = 0; // minimum milliseconds between publishes, 0 for every telegram
+  uint8_t priority = READOUT_PRIORITY_NORMAL;
+  unsigned long lastSent = 0; // millis() of the last publish
   bool sendData = true;
+  bool unpublished = false; // sendData holds a new value, not only the full update refresh
 };
 
 struct TelegramDecodedObject telegramObjects[NUMBER_OF_READOUTS];
+int numberOfReadouts = 0;
+
+// Candidate serial settings, tried in this order. detectTime is how long a candidate
+// gets to show a telegram, at least one telegram interval.
+struct P1SerialConfig
+{
+  unsigned long baud;
+  uint32_t framing;
+  bool crc; // telegrams end in a CRC
+  unsigned long detectTime;
+};
+
+struct P1SerialConfig p1SerialConfigs[] = {
+    {115200, SERIAL_8N1, true, 11000}, // DSMR 4.x (a telegram every 10 s), 5.x
+    {9600, SERIAL_7E1, false, 11000}, // DSMR 2.2, 3.0
+};
+#define P1_SERIAL_CONFIGS (int)(sizeof(p1SerialConfigs) / sizeof(p1SerialConfigs[0]))
+
+// Reader and decoder state of one P1 port. Ports share the readout table (codes,
+// names, lookup) but each decodes into its own objects.
+struct P1Port
+{
+  HardwareSerial *serial;
+  uart_port_t uart;
+  int rxPin;
+  int txPin;
+  int config;                      // index in p1SerialConfigs
+  int crcFailures;                 // invalid telegrams in a row
+  unsigned long lastValidMillis;
+  bool detecting;            // trying the p1SerialConfigs, see detect.ino
+  int detectFirst;           // config the detection started from
+  int detectTried;           // candidates tried so far
+  int detectPattern;         // progress through a telegram header
+  unsigned long detectSince; // millis() the current candidate started
+  const char *topic;
+  struct TelegramDecodedObject *objects;
+  uint8_t rx[P1_READ_CHUNK]; // read from the UART, not parsed yet
+  int rxPosition;
+  int rxLength;
+  bool inTelegram; // false while skipping to the next '/'
+  char telegram[P1_MAXLINELENGTH]; // line being assembled
+  int lineLength;
+  int telegramLines;
+  unsigned int currentCRC;
+  long staged[NUMBER_OF_READOUTS]; // values of the telegram being read, committed on a valid CRC
+  bool stagedFound[NUMBER_OF_READOUTS];
+  unsigned long timestamp; // meter time of the telegram being read, UTC
+  unsigned long peakTimestamp; // time of the month's peak demand (1-0:1.6.0) in that telegram, UTC
+  unsigned long sequence;
+  unsigned long startMicros;
+  unsigned long endMicros;
+  long lastUpdateSent;                // millis() of the last published telegram
+  unsigned long lastUpdateTimestamp; // meter time of the last published telegram
+  unsigned long discardedBytes; // skipped while resynchronising
+  unsigned long resyncs;
+  unsigned long truncatedTelegrams; // abandoned before their '!'
+  unsigned long invalidTelegrams;   // failed their CRC
+#ifdef POWER_SAVE
+  unsigned long period;        // milliseconds between telegrams, 0 until known (see power.ino)
+  unsigned long lastEndMillis; // millis() at the '!' of the last telegram
+  int periodOutliers;          // intervals in a row that did not fit period
+#endif
+#if defined(P1_REPEATER) && defined(P1_REPEATER_CRC_ONLY)
+  char repeatBuffer[P1_REPEATER_BUFFER];
+  int repeatLength;
+#endif
+};
+
+struct P1Port p1Ports[P1_PORTS];
+#ifdef P1_SECOND_PORT
+struct TelegramDecodedObject subMeterObjects[NUMBER_OF_READOUTS];
+#endif
+
+// Readout table entry as stored in NVS
+struct ReadoutTableEntry
+{
+  char code[16];
+  char name[READOUT_NAME_SIZE];
+  char startChar;
+  char endChar;
+  uint8_t flags;
+  uint8_t reserved;
+  long scale;
+  unsigned long interval; // since version 2
+};
+
+#define READOUT_FLAG_COUNTER 0x01
+#define READOUT_FLAG_ALWAYS 0x02
+#define READOUT_FLAG_HIGH 0x04
+#define READOUT_FLAG_LOW 0x08
+#define READOUT_TABLE_MAGIC 0x5031 // "P1"
+#define READOUT_TABLE_VERSION 2
+#define READOUT_TABLE_V1_ENTRY_SIZE offsetof(struct ReadoutTableEntry, interval)
+
+struct ReadoutTableHeader
+{
+  uint16_t magic;
+  uint8_t version;
+  uint8_t count;
+};
+
+// Open addressing hash of the OBIS codes, index in telegramObjects or -1
+int8_t readoutLookup[READOUT_LOOKUP_SIZE];
+unsigned int readoutTableCrc = 0;
+bool readoutTableStored = false;
+
+// Committed state of the main meter (port 0)
+// Meter time of the last telegram (0-0:1.0.0) as UTC seconds since epoch
+unsigned long meterTimestamp = 0;
+// Meter time of the peak demand of the month (1-0:1.6.0, Fluvius), 0 when unknown
+unsigned long meterPeakTimestamp = 0;
+// Incremented for every telegram with a valid CRC
+unsigned long telegramSequence = 0;
+// micros() when the first line ('/') and the last line ('!') of the current telegram were read
+unsigned long telegramStartMicros = 0;
+unsigned long telegramEndMicros = 0;
+// micros() when the CRC of the current telegram checked out
+unsigned long telegramCommitMicros = 0;
+
+struct TelegramSnapshot
+{
+  unsigned long sequence;
+  unsigned long timestamp;
+  long values[NUMBER_OF_READOUTS];
+};
+
+// The committed telegram of the main meter behind a sequence lock, for readers on any
+// task or core, see snapshot.ino
+struct SharedSnapshot
+{
+  uint32_t sequence; // odd while the writer is copying
+  struct TelegramSnapshot snapshot;
+};
+
+struct SharedSnapshot sharedSnapshot;
+
+struct OutboxRecord
+{
+  struct TelegramSnapshot snapshot;
+  unsigned int crc;
+};
+
+struct OutboxState
+{
+  unsigned long magic;
+  unsigned long recordSize;
+  unsigned long tableCrc; // readout table the records were written with
+  unsigned long head; // next record to write, counts up and wraps on OUTBOX_FLASH_SLOTS
+  unsigned long tail; // oldest record not yet replayed
+};
+
+struct HistoryBlock
+{
+  unsigned long firstTimestamp;
+  unsigned long lastTimestamp;
+  unsigned int count;      // samples in this block
+  unsigned long bitLength; // bits of data in use
+  uint8_t data[HISTORY_BLOCK_SIZE];
+};
+
+// Encoder or decoder position within a history block
+struct HistoryCursor
+{
+  int block; // 0 is the oldest block
+  unsigned int sample;
+  unsigned long bitPosition;
+  unsigned long timestamp;
+  long timestampDelta;
+  long values[NUMBER_OF_READOUTS];
+  long valueDeltas[NUMBER_OF_READOUTS];
+};
+
+struct HistoryBlock *historyBlocks = NULL;
+int historyBlockCapacity = 0;
+int historyFirstBlock = 0;
+int historyBlocksUsed = 0;
+struct HistoryCursor historyWriter;
+
+// Instantaneous readouts keep min/max/mean. Counters only go up, so for them
+// min is the first and max the last value of the interval, delta is max - min.
+struct RollupBucket
+{
+  unsigned long start; // UTC seconds
+  unsigned int count;  // telegrams in this interval
+  long min[NUMBER_OF_READOUTS];
+  long max[NUMBER_OF_READOUTS];
+  long mean[NUMBER_OF_READOUTS];
+};
+
+struct RollupTier
+{
+  unsigned long seconds;
+  const char *name;
+  int capacity;
+  int first;
+  int used;
+  struct RollupBucket *buckets;
+  struct RollupBucket current; // interval in progress, the mean is computed from sum when it closes
+  long long sum[NUMBER_OF_READOUTS];
+};
+
+struct RollupTier rollupTiers[ROLLUP_TIERS];
+
+struct HistoryQuery
+{
+  unsigned long from;
+  unsigned long to;
+  bool fields[NUMBER_OF_READOUTS];
+  int tier; // -1 for the raw history, else index in rollupTiers
+  bool binary;
+};
+
+// Rows are collected in a small buffer that is sent as soon as it is full,
+// a response is never buffered as a whole
+struct QueryOutput
+{
+  bool toMqtt;
+  int length;
+  char buffer[QUERY_CHUNK_SIZE];
+};
+
+// An SDM630 input register, computed as (readout + sign * other) * scale
+struct ModbusFloatRegister
+{
+  uint16_t address;
+  const char *readout;
+  const char *other;
+  int sign;
+  float scale;
+  int readoutIndex;
+  int otherIndex;
+};
+
+struct ModbusFloatRegister modbusFloatRegisters[] = {
+    {0x00, "instant_voltage_l1", NULL, 0, 0.001},
+    {0x02, "instant_voltage_l2", NULL, 0, 0.001},
+    {0x04, "instant_voltage_l3", NULL, 0, 0.001},
+    {0x06, "instant_power_current_l1", NULL, 0, 0.001},
+    {0x08, "instant_power_current_l2", NULL, 0, 0.001},
+    {0x0A, "instant_power_current_l3", NULL, 0, 0.001},
+    {0x0C, "instant_power_usage_l1", "instant_power_return_l1", -1, 1},
+    {0x0E, "instant_power_usage_l2", "instant_power_return_l2", -1, 1},
+    {0x10, "instant_power_usage_l3", "instant_power_return_l3", -1, 1},
+    {0x34, "actual_consumption", "actual_received", -1, 1},
+    {0x48, "consumption_tarif_1", "consumption_tarif_2", 1, 0.001},
+    {0x4A, "received_tarif_1", "received_tarif_2", 1, 0.001},
+};
+
+// A request of a Modbus client as far as it has arrived, TCP may split it anywhere
+struct ModbusFrame
+{
+  uint8_t data[MODBUS_FRAME_SIZE];
+  int length; // bytes received
+};
+
+struct ModbusFrame modbusFrames[MODBUS_MAX_CLIENTS]; // one per modbusClients slot
+uint16_t modbusInputRegisters[MODBUS_INPUT_REGISTERS];
+uint16_t modbusHoldingRegisters[2 * NUMBER_OF_READOUTS];
+unsigned long modbusRequests = 0;
+unsigned long modbusMaxServiceMicros = 0;
+
+struct EmulationReadouts
+{
+  int importTarif1;
+  int importTarif2;
+  int exportTarif1;
+  int exportTarif2;
+  int power;
+  int powerReturned;
+  int tarif;
+  int gas;
+  int powerUsage[3];
+  int powerReturn[3];
+  int voltage[3];
+  int current[3];
+};
+
+// Responses are serialized once per telegram, a poll only sends the buffer
+struct EmulationReadouts emulationReadouts;
+char homeWizardInfo[192];
+char homeWizardData[1024];
+int homeWizardDataLength = 0;
+char shellyEmeter[3][192];
+int shellyEmeterLength[3] = {0, 0, 0};
+char shellyStatus[768];
+int shellyStatusLength = 0;
+
+// A rule trips when its readout has been at or above on for holdTime milliseconds and
+// releases when it has been at or below off for holdTime milliseconds. Values use the
+// units of the MQTT topics (W, mA). A pin of -1 drives no GPIO, the rule only publishes
+// its MQTT event. No rule drives a pin out of the box, set the pin of the rules you wire up.
+struct GridLimitRule
+{
+  const char *name;
+  const char *readout;
+  long on;
+  long off;
+  unsigned long holdTime;
+  int pin;
+  int readoutIndex;
+  bool active;
+  bool pending;
+  unsigned long pendingSince;
+  bool publish;
+  unsigned long latencyMicros; // from the end of the telegram to the GPIO change
+  unsigned long ageMicros;     // from the start of the telegram to the GPIO change
+};
+
+struct GridLimitRule gridLimitRules[] = {
+    {"consumption", "actual_consumption", 9000, 8500, 0, -1},               // e.g. pin 25
+    {"current_l1", "instant_power_current_l1", 25000, 23000, 2000, -1}, // e.g. pin 26 for all phases
+    {"current_l2", "instant_power_current_l2", 25000, 23000, 2000, -1},
+    {"current_l3", "instant_power_current_l3", 25000, 23000, 2000, -1},
+};
+
+struct CapacityMonth
+{
+  long month; // year * 12 + month - 1, 0 when unused
+  long peak;  // W, highest quarter hour average
+  unsigned long peakStart;
+};
+
+struct CapacityQuarter
+{
+  unsigned long start;
+  unsigned long lastTimestamp;
+  long lastPower;        // W
+  long long energy;      // Ws imported since start
+  unsigned long covered; // seconds of the quarter with a measurement
+};
+
+int capacityPowerIndex = -1;
+int capacityMeterAverageIndex = -1;
+int capacityMeterPeakIndex = -1;
+struct CapacityQuarter capacityQuarter;
+struct CapacityMonth capacityMonths[CAPACITY_MONTHS];
+
+struct EnergyIntegrator
+{
+  const char *energyReadout; // official register, Wh
+  const char *powerReadout;  // W
+  long tarif;                // integrates only while this tarif is active
+  int energyIndex;
+  int powerIndex;
+  long anchor;          // Wh, last value of the official register
+  long long integrated; // Ws since the register changed
+  long lastPower;
+};
+
+struct EnergyIntegrator energyIntegrators[] = {
+    {"consumption_tarif_1", "actual_consumption", 1},
+    {"consumption_tarif_2", "actual_consumption", 2},
+    {"received_tarif_1", "actual_received", 1},
+    {"received_tarif_2", "actual_received", 2},
+};
+int energyTarifIndex = -1;
+unsigned long energyLastTimestamp = 0;
+
+// Last committed state, kept in RTC memory over a restart (not over a power cycle), see retain.ino
+struct RetainedEnergy
+{
+  long anchor;
+  long long integrated;
+  long lastPower;
+};
+
+struct RetainedRollup
+{
+  struct RollupBucket current;
+  long long sum[NUMBER_OF_READOUTS];
+};
+
+struct RetainedState
+{
+  uint32_t magic;
+  uint32_t size;          // sizeof(RetainedState), changes with the layout
+  unsigned int tableCrc;  // readout table the values belong to
+  long values[P1_PORTS][NUMBER_OF_READOUTS];
+  bool pending[P1_PORTS][NUMBER_OF_READOUTS]; // sendData, changes not published yet
+  unsigned long sequences[P1_PORTS];
+  unsigned long meterTimestamp;
+  struct CapacityQuarter capacityQuarter;
+  struct CapacityMonth capacityMonths[CAPACITY_MONTHS];
+  struct RetainedEnergy energy[sizeof(energyIntegrators) / sizeof(energyIntegrators[0])];
+  unsigned long energyLastTimestamp;
+  struct RetainedRollup rollups[ROLLUP_TIERS];
+  unsigned int crc; // crc16 of everything above
+};
+
+RTC_NOINIT_ATTR struct RetainedState retainedState;
+
+struct DerivedReadouts
+{
+  int consumption;
+  int received;
+  int powerUsage[3];
+  int powerReturn[3];
+  int current[3];
+  int netPower;
+  int netPhasePower[3];
+  int imbalanceCurrent;
+  int imbalancePower;
+};
+
+struct DerivedReadouts derivedReadouts;
+
+struct TelegramSnapshot outboxRam[OUTBOX_RAM_SLOTS];
+int outboxRamFirst = 0;
+int outboxRamCount = 0;
+struct OutboxState outboxState;
+unsigned long outboxDropped = 0;
+long outboxReplayHoldoff = 0;
+
+// Stages of a telegram: '/' to '!', '!' to CRC commit, commit to the start of
+// publishing, publishing, and '/' to the last publish written
+enum LatencyStage
+{
+  LATENCY_RECEIVE,
+  LATENCY_COMMIT,
+  LATENCY_QUEUE,
+  LATENCY_PUBLISH,
+  LATENCY_TOTAL,
+  LATENCY_STAGES
+};
+
+struct LatencyHistogram
+{
+  const char *name;
+  unsigned long count;
+  unsigned long max; // microseconds
+  unsigned long buckets[LATENCY_BUCKETS];
+};
+
+struct LatencyHistogram latencyHistograms[LATENCY_STAGES] = {
+    {"receive"},
+    {"commit"},
+    {"queue"},
+    {"publish"},
+    {"total"},
+};
+
+// Slot of the log ring. sequence tells producers and the consumer whose turn it is,
+// see logPush() and logDrain().
+struct LogRecord
+{
+  volatile uint32_t sequence;
+  uint32_t millis;
+  const char *format;
+  uint8_t level;
+  uint32_t args[LOG_MAX_ARGS];
+};
+
+struct LogRecord logRing[LOG_RING_SIZE];
+uint32_t logHead = 0; // next slot to write, shared by all producers
+uint32_t logTail = 0; // next slot to drain
+uint32_t logDropped = 0;
+
+// Access point of the last WiFi connection, survives a restart but not a power cycle
+struct WifiCache
+{
+  uint8_t bssid[6];
+  int32_t channel;
+  unsigned int crc;
+};
 
-unsigned int currentCRC = 0;
+RTC_NOINIT_ATTR struct WifiCache wifiCache;
+bool wifiFastConnect = false;   // the current attempt uses wifiCache
+bool networkStarted = false;    // OTA, HTTP and Modbus are started on the first connection
+unsigned long wifiConnectedMillis = 0;
+unsigned long firstPublishMillis = 0;
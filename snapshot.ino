@@ -0,0 +1,62 @@
+/**
+ *  Shared telegram snapshot.
+ *
+ *  decodeTelegram() publishes every committed telegram of the main meter to
+ *  sharedSnapshot under a sequence lock. The writer makes the sequence odd, copies
+ *  the values and makes it even again. A reader copies the snapshot between two loads
+ *  of the sequence and retries when it was odd or has changed. The writer never waits
+ *  for a reader and a reader never sees values of two different telegrams, from
+ *  whatever task or core it runs. With one telegram a second a retry is rare.
+ *
+ *  The values are copied word by word with relaxed atomics, the fences order them
+ *  against the sequence (the seqlock of Boehm, "Can seqlocks get along with programming
+ *  language memory models?"). test/test_snapshot.cpp runs it from threads.
+ */
+
+void snapshotPublish()
+{
+    uint32_t sequence = __atomic_load_n(&sharedSnapshot.sequence, __ATOMIC_RELAXED);
+    __atomic_store_n(&sharedSnapshot.sequence, sequence + 1, __ATOMIC_RELAXED);
+    // A reader that loads any of the values below also sees the odd sequence (pairs
+    // with the acquire fence in snapshotRead())
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&sharedSnapshot.snapshot.sequence, telegramSequence, __ATOMIC_RELAXED);
+    __atomic_store_n(&sharedSnapshot.snapshot.timestamp, meterTimestamp, __ATOMIC_RELAXED);
+    for (int i = 0; i < NUMBER_OF_READOUTS; i++)
+    {
+        __atomic_store_n(&sharedSnapshot.snapshot.values[i], i < numberOfReadouts ? telegramObjects[i].value : 0, __ATOMIC_RELAXED);
+    }
+
+    // A reader that loads this sequence also sees all the values above
+    __atomic_store_n(&sharedSnapshot.sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ *  Copies the latest committed telegram into snapshot.
+ */
+void snapshotRead(struct TelegramSnapshot &snapshot)
+{
+    while (true)
+    {
+        uint32_t sequence = __atomic_load_n(&sharedSnapshot.sequence, __ATOMIC_ACQUIRE);
+        if (sequence & 1)
+        {
+            // The writer is copying, let it finish when it runs at a lower priority
+            vTaskDelay(1);
+            continue;
+        }
+
+        snapshot.sequence = __atomic_load_n(&sharedSnapshot.snapshot.sequence, __ATOMIC_RELAXED);
+        snapshot.timestamp = __atomic_load_n(&sharedSnapshot.snapshot.timestamp, __ATOMIC_RELAXED);
+        for (int i = 0; i < NUMBER_OF_READOUTS; i++)
+        {
+            snapshot.values[i] = __atomic_load_n(&sharedSnapshot.snapshot.values[i], __ATOMIC_RELAXED);
+        }
+
+        // The values are loaded before the sequence is checked again
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&sharedSnapshot.sequence, __ATOMIC_RELAXED) == sequence)
+            return;
+    }
+}
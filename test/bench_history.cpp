@@ -0,0 +1,131 @@
+// Fills the history with two days of simulated one second telegrams of a household with
+// solar panels and reports what a telegram costs and how many hours the blocks hold, which
+// has to be at least 24. Every retained sample is decoded again and compared with what
+// was appended.
+#include "sketch.cpp"
+#include <cmath>
+#include <vector>
+
+double noise(double amplitude)
+{
+    return amplitude * ((rand() % 2001) - 1000) / 1000.0;
+}
+
+void set(const char *name, long value)
+{
+    int index = findReadout(name);
+    if (index >= 0)
+        telegramObjects[index].value = value;
+}
+
+int main()
+{
+    setupReadoutTable();
+    setupDerivedMetrics();
+    setupHistory();
+    srand(1);
+
+    const unsigned long start = 1618000000; // midnight
+    const int seconds = 2 * 24 * 3600;
+    const double share[3] = {0.5, 0.3, 0.2};
+    double energy[4] = {1869223, 1734506, 201533, 434128}; // Wh
+    double gas = 2569646;                                  // dm3
+    double demand = 300, fridge = 0, appliance = 0;
+    int applianceLeft = 0;
+    long voltage[3] = {230100, 231300, 229800};
+    std::vector<std::vector<long>> appended;
+
+    for (int s = 0; s < seconds; s++)
+    {
+        double hour = (s % 86400) / 3600.0;
+        fridge = (s % 3600) < 1200 ? 90 : 0;
+        if (applianceLeft == 0 && rand() % 2400 == 0)
+        {
+            appliance = 800 + rand() % 1500;
+            applianceLeft = 60 + rand() % 600;
+        }
+        if (applianceLeft > 0 && --applianceLeft == 0)
+            appliance = 0;
+        double solar = hour > 7 && hour < 19 ? 3000 * sin((hour - 7) / 12 * M_PI) * (0.8 + noise(0.2)) : 0;
+        bool peak = hour >= 7 && hour < 23;
+        set("actual_tarif_group", peak ? 1 : 2);
+
+        long usage[3], returned[3], total = 0, totalReturned = 0;
+        for (int phase = 0; phase < 3; phase++)
+        {
+            double power = (180 + fridge + appliance) * share[phase] + noise(15) - (phase == 0 ? solar : 0);
+            usage[phase] = power > 0 ? lround(power) : 0;
+            returned[phase] = power < 0 ? lround(-power) : 0;
+            total += usage[phase];
+            totalReturned += returned[phase];
+            voltage[phase] += 100 * (rand() % 3 - 1);
+            voltage[phase] = voltage[phase] < 226000 ? 226000 : voltage[phase] > 236000 ? 236000 : voltage[phase];
+        }
+        long net = total - totalReturned;
+        energy[peak ? 1 : 0] += net > 0 ? net / 3600.0 : 0;
+        energy[peak ? 3 : 2] += net < 0 ? -net / 3600.0 : 0;
+        if (s % 300 == 0)
+            gas += rand() % 40;
+        demand += (net - demand) / 900;
+
+        set("consumption_tarif_1", (long)energy[0]);
+        set("consumption_tarif_2", (long)energy[1]);
+        set("received_tarif_1", (long)energy[2]);
+        set("received_tarif_2", (long)energy[3]);
+        set("actual_consumption", net > 0 ? net : 0);
+        set("actual_received", net < 0 ? -net : 0);
+        const char *names[][4] = {{"instant_power_usage_l1", "instant_power_return_l1", "instant_power_current_l1", "instant_voltage_l1"},
+                                  {"instant_power_usage_l2", "instant_power_return_l2", "instant_power_current_l2", "instant_voltage_l2"},
+                                  {"instant_power_usage_l3", "instant_power_return_l3", "instant_power_current_l3", "instant_voltage_l3"}};
+        for (int phase = 0; phase < 3; phase++)
+        {
+            set(names[phase][0], usage[phase]);
+            set(names[phase][1], returned[phase]);
+            set(names[phase][2], 1000 * ((usage[phase] + returned[phase]) * 1000 / voltage[phase]));
+            set(names[phase][3], voltage[phase]);
+        }
+        set("gas_meter_m3", (long)gas);
+        set("current_average_demand", lround(demand > 0 ? demand : 0));
+        set("maximum_demand_month", 4302);
+        computeDerivedMetrics();
+
+        meterTimestamp = start + s;
+        historyAppendTelegram();
+        std::vector<long> values(numberOfReadouts + 1);
+        values[0] = meterTimestamp;
+        for (int i = 0; i < numberOfReadouts; i++)
+            values[i + 1] = telegramObjects[i].value;
+        appended.push_back(values);
+    }
+
+    // Compare the retained samples, the newest ones, with what was appended
+    struct HistoryCursor cursor;
+    historySeekBlock(cursor, 0);
+    size_t retained = 0;
+    unsigned long first = historyBlockAt(0)->firstTimestamp;
+    size_t offset = first - start;
+    int mismatches = 0;
+    while (historyNext(cursor))
+    {
+        const std::vector<long> &values = appended[offset + retained++];
+        bool same = cursor.timestamp == (unsigned long)values[0];
+        for (int i = 0; i < numberOfReadouts; i++)
+            same = same && cursor.values[i] == values[i + 1];
+        if (!same && mismatches++ < 5)
+            printf("sample %zu decoded differently\n", offset + retained - 1);
+    }
+
+    // The newest block is still filling, leave it out of the cost per telegram
+    unsigned long bits = 0, samples = 0;
+    for (int block = 0; block < historyBlocksUsed - 1; block++)
+    {
+        bits += historyBlockAt(block)->bitLength;
+        samples += historyBlockAt(block)->count;
+    }
+    double bytesPerTelegram = (double)HISTORY_BLOCK_SIZE * (historyBlocksUsed - 1) / samples;
+    double hours = (historyBlockAt(historyBlocksUsed - 1)->lastTimestamp - first) / 3600.0;
+    printf("%d readouts, %.1f bytes (%.0f bits used) per telegram, %d blocks of %d bytes hold %.1f hours\n",
+           numberOfReadouts, bytesPerTelegram, (double)bits / samples, historyBlockCapacity, HISTORY_BLOCK_SIZE, hours);
+    printf("%zu samples retained, %d decoded differently\n", retained, mismatches);
+    return mismatches != 0 || retained + offset != appended.size() || hours < 24;
+}
@@ -0,0 +1,69 @@
+// Fault injection: 1000 telegrams with random bytes flipped at a given rate per byte and,
+// before one in four of them, a burst of up to 40 random bytes. One in twenty is preceded by
+// a run of printable garbage without a '\n', longer than a line, so the '/' of the telegram
+// arrives in the part of a line that does not fit. Every telegram that arrived undamaged
+// has to be recovered.
+#include "sketch.cpp"
+#include "telegrams.h"
+
+int main()
+{
+    setupReadoutTable();
+    setupDerivedMetrics();
+    setupGridLimits();
+    setupP1Ports();
+    srand(1);
+
+    struct P1Port &port = p1Ports[0];
+    port.detecting = false;
+    int failures = 0;
+    for (double rate : {0.0, 0.0001, 0.0005, 0.001, 0.005})
+    {
+        std::string stream;
+        int telegrams = 1000, clean = 0;
+        for (int t = 0; t < telegrams; t++)
+        {
+            if (rand() % 4 == 0)
+            {
+                int burst = rand() % 40;
+                for (int i = 0; i < burst; i++)
+                    stream += (char)(rand() % 256);
+            }
+            if (rand() % 20 == 0)
+            {
+                int run = P1_MAXLINELENGTH + rand() % P1_MAXLINELENGTH;
+                for (int i = 0; i < run; i++)
+                    stream += (char)(0x20 + rand() % 95);
+            }
+            std::string telegram = testTelegram;
+            bool damaged = false;
+            for (char &c : telegram)
+            {
+                if (rand() < rate * RAND_MAX)
+                {
+                    c = rand() % 256;
+                    damaged = true;
+                }
+            }
+            clean += !damaged;
+            stream += telegram;
+        }
+
+        port.discardedBytes = port.resyncs = port.truncatedTelegrams = port.invalidTelegrams = 0;
+        port.lastValidMillis = millis();
+        port.serial->feedBytes(stream.data(), stream.size());
+        int recovered = 0;
+        while (port.serial->available() > 0 || port.rxPosition < port.rxLength)
+        {
+            if (readP1Serial(port))
+                recovered++;
+            port.lastValidMillis = millis(); // keep the detection out of it
+        }
+
+        printf("noise %.4f: %d/%d recovered, %d sent undamaged, discarded %lu resyncs %lu truncated %lu invalid %lu\n", rate,
+               recovered, telegrams, clean, port.discardedBytes, port.resyncs, port.truncatedTelegrams, port.invalidTelegrams);
+        if (recovered < clean)
+            failures++;
+    }
+    return failures != 0;
+}
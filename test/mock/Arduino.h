@@ -0,0 +1,151 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+#include <ctype.h>
+#include <string>
+#include <functional>
+#include <type_traits>
+#define HIGH 1
+#define LOW 0
+#define OUTPUT 1
+#define INPUT 0
+#define LED_BUILTIN 2
+#define F(x) x
+#define SERIAL_8N1 0x800001c
+#define SERIAL_7E1 0x8000018
+typedef bool boolean;
+typedef uint8_t byte;
+class String {
+public:
+  std::string s;
+  String() {}
+  String(const char *c) : s(c ? c : "") {}
+  String(const std::string &c) : s(c) {}
+  String(long v) : s(std::to_string(v)) {}
+  String(int v) : s(std::to_string(v)) {}
+  String(unsigned long v) : s(std::to_string(v)) {}
+  String(unsigned int v) : s(std::to_string(v)) {}
+  String(double v, int d = 2) : s(std::to_string(v)) {}
+  String operator+(const String &o) const { return String(s + o.s); }
+  String operator+(const char *o) const { return String(s + o); }
+  template <class T, class = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+  String operator+(T o) const { return String(s + std::to_string(o)); }
+  String &operator+=(const String &o) { s += o.s; return *this; }
+  String &operator+=(const char *o) { s += o; return *this; }
+  String &operator+=(char o) { s += o; return *this; }
+  bool operator==(const char *o) const { return s == o; }
+  bool operator==(const String &o) const { return s == o.s; }
+  const char *c_str() const { return s.c_str(); }
+  unsigned int length() const { return s.size(); }
+  long toInt() const { return atol(s.c_str()); }
+  bool startsWith(const char *p) const { return s.rfind(p, 0) == 0; }
+  int indexOf(char c, unsigned int from = 0) const { auto p = s.find(c, from); return p == std::string::npos ? -1 : (int)p; }
+  String substring(unsigned int a, unsigned int b = (unsigned)-1) const { return String(s.substr(a, b - a)); }
+  void reserve(unsigned int) {}
+};
+inline String operator+(const char *a, const String &b) { return String(std::string(a) + b.s); }
+class Print {
+public:
+  size_t print(const char *) { return 0; }
+  size_t print(const String &) { return 0; }
+  size_t print(char) { return 0; }
+  size_t print(long, int = 10) { return 0; }
+  size_t print(unsigned long, int = 10) { return 0; }
+  size_t print(int, int = 10) { return 0; }
+  size_t print(unsigned int, int = 10) { return 0; }
+  size_t print(double, int = 2) { return 0; }
+  size_t println() { return 0; }
+  size_t println(const char *) { return 0; }
+  size_t println(const String &) { return 0; }
+  size_t println(long, int = 10) { return 0; }
+  size_t println(unsigned long, int = 10) { return 0; }
+  size_t println(int, int = 10) { return 0; }
+  size_t println(unsigned int, int = 10) { return 0; }
+  size_t println(double, int = 2) { return 0; }
+  size_t printf(const char *, ...) { return 0; }
+  virtual size_t write(uint8_t) { return 1; }
+  virtual size_t write(const uint8_t *, size_t n) { return n; }
+  size_t write(const char *b, size_t n) { return write((const uint8_t *)b, n); }
+  virtual int availableForWrite() { return 128; }
+  virtual void flush() {}
+};
+class Stream : public Print {
+public:
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual int peek() { return -1; }
+  size_t read(uint8_t *b, size_t n) { return 0; }
+  size_t readBytes(char *b, size_t n) { return 0; }
+  size_t readBytes(uint8_t *b, size_t n) { return 0; }
+  size_t readBytesUntil(char t, char *b, size_t n) { return 0; }
+  void setTimeout(unsigned long) {}
+};
+typedef std::function<void(void)> OnReceiveCb;
+// Receives the bytes between feedPosition and feedLength of feed, keeps what the sketch
+// writes in written. availableForWrite() is always txRoom, as if the UART keeps up.
+class HardwareSerial : public Stream {
+public:
+  const uint8_t *feed = 0;
+  size_t feedLength = 0;
+  size_t feedPosition = 0;
+  std::string written;
+  int txRoom = 128;
+  HardwareSerial(int) {}
+  using Print::write;
+  size_t write(const uint8_t *b, size_t n) override { written.append((const char *)b, n); return n; }
+  size_t write(uint8_t c) override { written += (char)c; return 1; }
+  int availableForWrite() override { return txRoom; }
+  void feedBytes(const void *data, size_t length) { feed = (const uint8_t *)data; feedLength = length; feedPosition = 0; }
+  int available() override { return feedLength - feedPosition; }
+  int read() override { return feedPosition < feedLength ? feed[feedPosition++] : -1; }
+  size_t read(uint8_t *b, size_t n)
+  {
+    if (n > feedLength - feedPosition)
+      n = feedLength - feedPosition;
+    memcpy(b, feed + feedPosition, n);
+    feedPosition += n;
+    return n;
+  }
+  void begin(unsigned long, uint32_t = SERIAL_8N1, int8_t = -1, int8_t = -1, bool = false, unsigned long = 20000UL, uint8_t = 112) {}
+  void end() {}
+  size_t setRxBufferSize(size_t n) { return n; }
+  size_t setTxBufferSize(size_t n) { return n; }
+  void onReceive(OnReceiveCb, bool = false) {}
+  void updateBaudRate(unsigned long) {}
+  operator bool() const { return true; }
+};
+extern HardwareSerial Serial, Serial1, Serial2;
+extern unsigned long mockMillis; // what millis() returns, micros() is mockMillis * 1000
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long);
+void delayMicroseconds(unsigned int);
+void pinMode(uint8_t, uint8_t);
+void digitalWrite(uint8_t, uint8_t);
+int digitalRead(uint8_t);
+unsigned long pulseIn(uint8_t, uint8_t, unsigned long = 1000000L);
+void yield();
+long random(long);
+long random(long, long);
+void randomSeed(unsigned long);
+char *ltoa(long, char *, int);
+char *ultoa(unsigned long, char *, int);
+char *itoa(int, char *, int);
+template <class T> T min(T a, T b) { return a < b ? a : b; }
+template <class T> T max(T a, T b) { return a > b ? a : b; }
+class EspClass { public: void restart() {} uint32_t getFreeHeap() { return 0; } uint32_t getFreePsram() { return 0; } };
+extern EspClass ESP;
+bool psramFound();
+void *ps_malloc(size_t);
+void *ps_calloc(size_t, size_t);
+bool setCpuFrequencyMhz(uint32_t);
+#define IRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+typedef enum { ESP_RST_UNKNOWN, ESP_RST_POWERON, ESP_RST_EXT, ESP_RST_SW, ESP_RST_PANIC, ESP_RST_INT_WDT, ESP_RST_TASK_WDT, ESP_RST_WDT, ESP_RST_DEEPSLEEP, ESP_RST_BROWNOUT, ESP_RST_SDIO } esp_reset_reason_t;
+esp_reset_reason_t esp_reset_reason();
@@ -0,0 +1,22 @@
+#pragma once
+#include <Arduino.h>
+typedef int ota_error_t;
+#define U_FLASH 0
+#define OTA_AUTH_ERROR 0
+#define OTA_BEGIN_ERROR 1
+#define OTA_CONNECT_ERROR 2
+#define OTA_RECEIVE_ERROR 3
+#define OTA_END_ERROR 4
+class ArduinoOTAClass {
+public:
+  ArduinoOTAClass &onStart(std::function<void()>) { return *this; }
+  ArduinoOTAClass &onEnd(std::function<void()>) { return *this; }
+  ArduinoOTAClass &onProgress(std::function<void(unsigned int, unsigned int)>) { return *this; }
+  ArduinoOTAClass &onError(std::function<void(ota_error_t)>) { return *this; }
+  void begin() {}
+  void handle() {}
+  int getCommand() { return 0; }
+  ArduinoOTAClass &setHostname(const char *) { return *this; }
+  ArduinoOTAClass &setPassword(const char *) { return *this; }
+};
+extern ArduinoOTAClass ArduinoOTA;
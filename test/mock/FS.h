@@ -0,0 +1,28 @@
+#pragma once
+#include <Arduino.h>
+#define SeekSet 0
+#define SeekCur 1
+#define SeekEnd 2
+namespace fs {
+class File : public Stream {
+public:
+  operator bool() const { return false; }
+  size_t write(const uint8_t *, size_t n) override { return n; }
+  size_t read(uint8_t *, size_t) { return 0; }
+  int read() override { return -1; }
+  bool seek(uint32_t, int = SeekSet) { return true; }
+  size_t position() const { return 0; }
+  size_t size() const { return 0; }
+  void close() {}
+  const char *name() const { return ""; }
+};
+class FS {
+public:
+  File open(const char *, const char * = "r", bool = false) { return File(); }
+  bool exists(const char *) { return false; }
+  bool remove(const char *) { return true; }
+  bool rename(const char *, const char *) { return true; }
+};
+}
+using fs::File;
+using fs::FS;
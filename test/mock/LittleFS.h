@@ -0,0 +1,4 @@
+#pragma once
+#include <FS.h>
+class LittleFSFS : public fs::FS { public: bool begin(bool = false, const char * = "/littlefs", uint8_t = 10, const char * = "spiffs") { return true; } void end() {} size_t totalBytes() { return 0; } size_t usedBytes() { return 0; } };
+extern LittleFSFS LittleFS;
@@ -0,0 +1,16 @@
+#pragma once
+#include <Arduino.h>
+class Preferences {
+public:
+  bool begin(const char *, bool = false) { return true; }
+  void end() {}
+  size_t getBytesLength(const char *) { return 0; }
+  size_t getBytes(const char *, void *, size_t) { return 0; }
+  size_t putBytes(const char *, const void *, size_t n) { return n; }
+  uint32_t getUInt(const char *, uint32_t d = 0) { return d; }
+  size_t putUInt(const char *, uint32_t) { return 4; }
+  uint8_t getUChar(const char *, uint8_t d = 0) { return d; }
+  size_t putUChar(const char *, uint8_t) { return 1; }
+  bool remove(const char *) { return true; }
+  bool isKey(const char *) { return false; }
+};
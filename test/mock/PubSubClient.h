@@ -0,0 +1,30 @@
+#pragma once
+#include <WiFi.h>
+#define MQTT_CALLBACK_SIGNATURE std::function<void(char *, uint8_t *, unsigned int)> callback
+// Called for every message published, for the tests that check what was sent
+extern std::function<void(const char *, const uint8_t *, unsigned int)> mockOnPublish;
+class PubSubClient {
+public:
+  PubSubClient(Client &) {}
+  PubSubClient &setServer(const char *, uint16_t) { return *this; }
+  PubSubClient &setCallback(MQTT_CALLBACK_SIGNATURE) { return *this; }
+  bool setBufferSize(uint16_t) { return true; }
+  bool connect(const char *, const char *, const char *) { return false; }
+  bool connected() { return false; }
+  bool loop() { return true; }
+  bool publish(const char *topic, const char *payload) { return publish(topic, (const uint8_t *)payload, strlen(payload), false); }
+  bool publish(const char *topic, const char *payload, bool) { return publish(topic, payload); }
+  bool publish(const char *topic, const uint8_t *payload, unsigned int length, bool) {
+    if (mockOnPublish)
+      mockOnPublish(topic, payload, length);
+    return true;
+  }
+  bool beginPublish(const char *topic, unsigned int, bool) { streamTopic = topic; streamed.clear(); return true; }
+  size_t write(const uint8_t *b, size_t n) { streamed.append((const char *)b, n); return n; }
+  size_t write(uint8_t c) { streamed += (char)c; return 1; }
+  int endPublish() { return publish(streamTopic.c_str(), (const uint8_t *)streamed.data(), streamed.size(), false); }
+  bool subscribe(const char *) { return true; }
+  int state() { return 0; }
+private:
+  std::string streamTopic, streamed;
+};
@@ -0,0 +1,25 @@
+#pragma once
+#include <WiFi.h>
+#define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_POST, HTTP_PUT };
+class WebServer {
+public:
+  WebServer(int) {}
+  void begin() {}
+  void handleClient() {}
+  void on(const char *, std::function<void()>) {}
+  void on(const char *, HTTPMethod, std::function<void()>) {}
+  void onNotFound(std::function<void()>) {}
+  String arg(const char *) { return String(); }
+  String arg(int) { return String(); }
+  bool hasArg(const char *) { return false; }
+  String uri() { return String(); }
+  void send(int, const char * = "", const String & = String()) {}
+  void send(int, const char *, const char *) {}
+  void send_P(int, const char *, const char *, size_t) {}
+  void sendHeader(const char *, const char *, bool = false) {}
+  void setContentLength(size_t) {}
+  void sendContent(const char *, size_t) {}
+  void sendContent(const String &) {}
+  WiFiClient client() { return WiFiClient(); }
+};
@@ -0,0 +1,57 @@
+#pragma once
+#include <Arduino.h>
+#define WL_CONNECTED 3
+#define WIFI_STA 1
+class IPAddress { public: IPAddress() {} IPAddress(uint8_t, uint8_t, uint8_t, uint8_t) {} bool fromString(const char *) { return true; } String toString() const { return String(); } operator uint32_t() const { return 0; } uint8_t operator[](int) const { return 0; } };
+class Client : public Stream {
+public:
+  virtual int connect(const char *, uint16_t) { return 0; }
+  virtual uint8_t connected() { return 0; }
+  virtual void stop() {}
+  operator bool() { return true; }
+  void setNoDelay(bool) {}
+};
+// Receives the bytes of input from inputPosition on, keeps what the sketch writes in output
+class WiFiClient : public Client {
+public:
+  std::string input, output;
+  size_t inputPosition = 0;
+  bool open = false;
+  int available() override { return input.size() - inputPosition; }
+  int read(uint8_t *b, size_t n) {
+    n = n < (size_t)available() ? n : available();
+    memcpy(b, input.data() + inputPosition, n);
+    inputPosition += n;
+    return n;
+  }
+  int read() override { return available() > 0 ? (uint8_t)input[inputPosition++] : -1; }
+  using Print::write;
+  size_t write(const uint8_t *b, size_t n) override { output.append((const char *)b, n); return n; }
+  uint8_t connected() override { return open; }
+  void stop() override { open = false; }
+};
+class WiFiServer { public: WiFiServer(uint16_t) {} void begin() {} WiFiClient available() { return WiFiClient(); } WiFiClient accept() { return WiFiClient(); } bool hasClient() { return false; } void setNoDelay(bool) {} };
+typedef enum { ARDUINO_EVENT_WIFI_STA_START, ARDUINO_EVENT_WIFI_STA_CONNECTED, ARDUINO_EVENT_WIFI_STA_DISCONNECTED, ARDUINO_EVENT_WIFI_STA_GOT_IP, ARDUINO_EVENT_WIFI_STA_LOST_IP } arduino_event_id_t;
+typedef arduino_event_id_t WiFiEvent_t;
+typedef void (*WiFiEventCb)(arduino_event_id_t);
+class WiFiClass {
+public:
+  int onEvent(WiFiEventCb, arduino_event_id_t = ARDUINO_EVENT_WIFI_STA_START) { return 0; }
+  int status() { return 0; }
+  void mode(int) {}
+  int begin(const char *, const char *, int32_t = 0, const uint8_t * = 0, bool = true) { return 0; }
+  uint8_t waitForConnectResult(unsigned long = 60000) { return 0; }
+  IPAddress localIP() { return IPAddress(); }
+  bool config(IPAddress, IPAddress, IPAddress, IPAddress = IPAddress(), IPAddress = IPAddress()) { return true; }
+  uint8_t *BSSID() { return 0; }
+  int32_t channel() { return 0; }
+  bool setSleep(bool) { return true; }
+  bool disconnect(bool = false) { return true; }
+  String macAddress() { return String(); }
+  int8_t RSSI() { return 0; }
+  bool setAutoReconnect(bool) { return true; }
+  bool persistent(bool) { return true; }
+  bool reconnect() { return true; }
+  void setHostname(const char *) {}
+};
+extern WiFiClass WiFi;
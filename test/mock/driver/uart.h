@@ -0,0 +1,12 @@
+#pragma once
+#include <stdint.h>
+typedef int uart_port_t;
+typedef int esp_err_t;
+#define UART_NUM_0 0
+#define UART_NUM_1 1
+#define UART_NUM_2 2
+#define UART_SIGNAL_RXD_INV (1 << 2)
+#define UART_SIGNAL_TXD_INV (1 << 5)
+esp_err_t uart_set_line_inverse(uart_port_t, uint32_t);
+esp_err_t uart_wait_tx_done(uart_port_t, uint32_t);
+esp_err_t uart_set_wakeup_threshold(uart_port_t, int);
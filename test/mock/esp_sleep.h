@@ -0,0 +1,6 @@
+#pragma once
+#include <esp_pm.h>
+typedef enum { GPIO_INTR_LOW_LEVEL = 4, GPIO_INTR_HIGH_LEVEL = 5 } gpio_int_type_t;
+typedef int gpio_num_t;
+esp_err_t gpio_wakeup_enable(gpio_num_t, gpio_int_type_t);
+esp_err_t esp_sleep_enable_gpio_wakeup();
@@ -0,0 +1,8 @@
+#pragma once
+#include <freertos/FreeRTOS.h>
+typedef uint32_t EventBits_t;
+typedef void *EventGroupHandle_t;
+EventGroupHandle_t xEventGroupCreate();
+EventBits_t xEventGroupSetBits(EventGroupHandle_t, EventBits_t);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t, EventBits_t);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t, EventBits_t, BaseType_t, BaseType_t, TickType_t);
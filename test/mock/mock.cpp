@@ -0,0 +1,63 @@
+// Host implementations of the Arduino and ESP-IDF functions the sketch calls
+#include <Arduino.h>
+#include <ArduinoOTA.h>
+#include <LittleFS.h>
+#include <PubSubClient.h>
+#include <WiFi.h>
+#include <driver/uart.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+
+unsigned long mockMillis = 0;
+
+HardwareSerial Serial(0), Serial1(1), Serial2(2);
+EspClass ESP;
+WiFiClass WiFi;
+LittleFSFS LittleFS;
+ArduinoOTAClass ArduinoOTA;
+std::function<void(const char *, const uint8_t *, unsigned int)> mockOnPublish;
+
+unsigned long millis() { return mockMillis; }
+unsigned long micros() { return mockMillis * 1000; }
+void delay(unsigned long ms) { mockMillis += ms; }
+void delayMicroseconds(unsigned int) {}
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t, uint8_t) {}
+int digitalRead(uint8_t) { return LOW; }
+unsigned long pulseIn(uint8_t, uint8_t, unsigned long) { return 0; }
+void yield() {}
+long random(long max) { return max > 0 ? rand() % max : 0; }
+long random(long min, long max) { return min + random(max - min); }
+void randomSeed(unsigned long seed) { srand(seed); }
+char *ltoa(long value, char *buffer, int) { sprintf(buffer, "%ld", value); return buffer; }
+char *ultoa(unsigned long value, char *buffer, int) { sprintf(buffer, "%lu", value); return buffer; }
+char *itoa(int value, char *buffer, int) { sprintf(buffer, "%d", value); return buffer; }
+bool psramFound() { return true; }
+void *ps_malloc(size_t size) { return malloc(size); }
+void *ps_calloc(size_t count, size_t size) { return calloc(count, size); }
+bool setCpuFrequencyMhz(uint32_t) { return true; }
+esp_reset_reason_t esp_reset_reason() { return ESP_RST_POWERON; }
+
+esp_err_t uart_set_line_inverse(uart_port_t, uint32_t) { return 0; }
+esp_err_t uart_wait_tx_done(uart_port_t, uint32_t) { return 0; }
+esp_err_t uart_set_wakeup_threshold(uart_port_t, int) { return 0; }
+esp_err_t esp_pm_configure(const void *) { return -1; }
+esp_err_t esp_pm_lock_create(esp_pm_lock_type_t, int, const char *, esp_pm_lock_handle_t *) { return -1; }
+esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t) { return 0; }
+esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t) { return 0; }
+esp_err_t gpio_wakeup_enable(gpio_num_t, gpio_int_type_t) { return 0; }
+esp_err_t esp_sleep_enable_gpio_wakeup() { return 0; }
+
+static EventBits_t mockEventBits;
+EventGroupHandle_t xEventGroupCreate() { return &mockEventBits; }
+EventBits_t xEventGroupSetBits(EventGroupHandle_t, EventBits_t bits) { return mockEventBits |= bits; }
+EventBits_t xEventGroupClearBits(EventGroupHandle_t, EventBits_t bits) { return mockEventBits &= ~bits; }
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t, EventBits_t bits, BaseType_t clear, BaseType_t, TickType_t)
+{
+    EventBits_t set = mockEventBits & bits;
+    if (clear)
+        mockEventBits &= ~bits;
+    return set;
+}
@@ -0,0 +1,35 @@
+#!/usr/bin/env python3
+"""Turns the sketch into one C++ file the way the Arduino builder does: the main .ino
+first, the others in alphabetical order, with prototypes of all functions up front."""
+import glob, os, re, sys
+
+sketch, output = sys.argv[1], sys.argv[2]
+main = os.path.join(sketch, 'esp32_p1meter.ino')
+files = [main] + sorted(f for f in glob.glob(os.path.join(sketch, '*.ino')) if f != main)
+
+lines = []
+for f in files:
+    lines.append('#line 1 "%s"' % os.path.abspath(f))
+    lines.extend(open(f).read().split('\n'))
+
+definition = re.compile(r'^(?!static_assert|return|else|if|for|while|switch|#|template)'
+                        r'([A-Za-z_][\w\s\*&:<>,]*?[\s\*&])([A-Za-z_]\w*)\((.*)\)\s*$')
+prototypes = []
+first = None
+for i, line in enumerate(lines):
+    m = definition.match(line)
+    if m and i + 1 < len(lines) and lines[i + 1].strip() == '{':
+        if first is None:
+            first = i
+        arguments = re.sub(r'\s*=\s*[^,]+', '', m.group(3))
+        prototypes.append('%s%s(%s);' % (m.group(1), m.group(2), arguments))
+
+# The #line in front of the first definition keeps compiler messages pointing at the .ino
+header = lines[:first]
+marker = max(i for i, line in enumerate(header) if line.startswith('#line '))
+offset = first - marker
+source = ['#include <Arduino.h>'] + header + prototypes
+source += ['#line %d "%s"' % (offset, lines[marker].split('"')[1])] + lines[first:]
+
+os.makedirs(os.path.dirname(output), exist_ok=True)
+open(output, 'w').write('\n'.join(source) + '\n')
@@ -0,0 +1,34 @@
+// Telegram of a Fluvius (Belgian DSMR 5) meter, serial numbers removed, CRC valid
+const char testTelegram[] = "/FLU5\\253769484_A\r\n"
+"0-0:96.1.4(50215)\r\n"
+"0-0:96.1.1(<serialnumber>)\r\n"
+"0-0:1.0.0(210410103019S)\r\n"
+"1-0:1.8.1(001869.223*kWh)\r\n"
+"1-0:1.8.2(002598.088*kWh)\r\n"
+"1-0:2.8.1(000535.014*kWh)\r\n"
+"1-0:2.8.2(000175.049*kWh)\r\n"
+"0-0:96.14.0(0002)\r\n"
+"1-0:1.7.0(00.052*kW)\r\n"
+"1-0:2.7.0(00.000*kW)\r\n"
+"1-0:21.7.0(00.000*kW)\r\n"
+"1-0:41.7.0(00.000*kW)\r\n"
+"1-0:61.7.0(00.081*kW)\r\n"
+"1-0:22.7.0(00.004*kW)\r\n"
+"1-0:42.7.0(00.023*kW)\r\n"
+"1-0:62.7.0(00.000*kW)\r\n"
+"1-0:32.7.0(237.8*V)\r\n"
+"1-0:52.7.0(238.1*V)\r\n"
+"1-0:72.7.0(241.1*V)\r\n"
+"1-0:31.7.0(000.74*A)\r\n"
+"1-0:51.7.0(000.52*A)\r\n"
+"1-0:71.7.0(000.69*A)\r\n"
+"0-0:96.3.10(1)\r\n"
+"0-0:17.0.0(999.9*kW)\r\n"
+"1-0:31.4.0(999*A)\r\n"
+"0-0:96.13.0()\r\n"
+"0-1:24.1.0(003)\r\n"
+"0-1:96.1.1(<serialnumber>)\r\n"
+"0-1:24.4.0(1)\r\n"
+"0-1:24.2.3(210410102502S)(00012.445*m3)\r\n"
+"!485C\r\n"
+;
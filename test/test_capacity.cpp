@@ -0,0 +1,69 @@
+// Follows the capacity tariff over telegrams built with a 1-0:1.6.0 line. The first quarter
+// after a boot is partial and must not set the month's peak, a complete one does. When the
+// meter reports a higher peak, its time has to come along with it.
+#include "sketch.cpp"
+#include <time.h>
+
+// Meter time (CEST) of a UTC timestamp, the way 0-0:1.0.0 and 1-0:1.6.0 carry it
+std::string meterTime(unsigned long utc)
+{
+    time_t local = utc + 7200;
+    char text[16];
+    strftime(text, sizeof(text), "%y%m%d%H%M%SS", gmtime(&local));
+    return text;
+}
+
+void feedTelegram(unsigned long utc, long power, unsigned long peakTime, long peak)
+{
+    char lines[256];
+    snprintf(lines, sizeof(lines),
+             "/FLU5\\253769484_A\r\n\r\n0-0:1.0.0(%s)\r\n1-0:1.7.0(%02ld.%03ld*kW)\r\n1-0:1.6.0(%s)(%02ld.%03ld*kW)\r\n!",
+             meterTime(utc).c_str(), power / 1000, power % 1000, meterTime(peakTime).c_str(), peak / 1000, peak % 1000);
+    static std::string telegram;
+    telegram = lines;
+    char crc[8];
+    snprintf(crc, sizeof(crc), "%04X\r\n", crc16(0, (unsigned char *)telegram.data(), telegram.size()));
+    telegram += crc;
+
+    p1Ports[0].serial->feedBytes(telegram.data(), telegram.size());
+    while (readP1Serial(p1Ports[0]))
+        capacityUpdate();
+}
+
+int main()
+{
+    setupReadoutTable();
+    setupDerivedMetrics();
+    setupGridLimits();
+    setupP1Ports();
+    setupCapacity();
+    p1Ports[0].detecting = false;
+    int failures = 0;
+
+    // Booted at 10:07:30, 5 kW until 10:15, then 1 kW for a complete quarter
+    const unsigned long quarter = 1617926400 + 8 * 3600 + 15 * 60; // 2021-04-09 10:15 CEST
+    const unsigned long oldPeak = quarter - 86400;
+    for (unsigned long t = quarter - 450; t <= quarter + CAPACITY_QUARTER; t++)
+        feedTelegram(t, t < quarter ? 5000 : 1000, oldPeak, 500);
+
+    struct CapacityMonth &month = capacityMonth(epochMonth(quarter));
+    if (month.peak != 1000 || month.peakStart != quarter)
+    {
+        printf("after a partial and a complete quarter: peak %ld W from %lu, expected 1000 W from %lu\n", month.peak,
+               month.peakStart, quarter);
+        failures++;
+    }
+
+    // The meter saw 3 kW at 18:31:12 the day before, while we were not running
+    const unsigned long meterPeak = quarter - 86400 + 8 * 3600 + 16 * 60 + 12;
+    feedTelegram(quarter + CAPACITY_QUARTER + 1, 1000, meterPeak, 3000);
+    if (month.peak != 3000 || month.peakStart != meterPeak - meterPeak % CAPACITY_QUARTER)
+    {
+        printf("after the meter's peak: peak %ld W from %lu, expected 3000 W from %lu\n", month.peak, month.peakStart,
+               meterPeak - meterPeak % CAPACITY_QUARTER);
+        failures++;
+    }
+
+    printf("month peak %ld W from %lu, %d failures\n", month.peak, month.peakStart, failures);
+    return failures != 0;
+}
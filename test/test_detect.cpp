@@ -0,0 +1,55 @@
+// Detection against a DSMR 4 meter, which sends a telegram every 10 seconds at 115200 baud.
+// Whenever its first telegram comes after detection started, the 115200 candidate has to
+// see it and the result has to be stored. On another candidate the telegram arrives as noise.
+#include "sketch.cpp"
+#include "telegrams.h"
+
+int main()
+{
+    setupLogger();
+    setupReadoutTable();
+    setupP1Ports();
+    struct P1Port &port = p1Ports[0];
+    const unsigned long period = 10000, step = 50;
+    int failures = 0;
+
+    for (unsigned long phase = 0; phase < period; phase += 500)
+    {
+        port.detecting = false;
+        port.config = 0;
+        p1StartDetection(port);
+        logDrain();
+        Serial.written.clear();
+
+        std::string received;
+        unsigned long start = millis(), detected = 0;
+        for (unsigned long t = 0; t < 3 * period && detected == 0; t += step)
+        {
+            mockMillis = start + t;
+            if (t % period == phase)
+            {
+                received = testTelegram;
+                if (port.config != 0)
+                {
+                    for (char &c : received)
+                        c ^= 0xA5; // wrong baud rate and framing
+                }
+                port.serial->feedBytes(received.data(), received.size());
+            }
+            readP1Serial(port);
+            if (!port.detecting)
+                detected = t;
+        }
+
+        logDrain();
+        bool stored = Serial.written.find("detected 115200 baud") != std::string::npos;
+        if (!stored || port.config != 0 || detected < phase || detected > phase + 500) // a chunk per pass
+        {
+            printf("first telegram after %lu ms: %s at %lu ms\n", phase, stored ? "stored" : "not stored", detected);
+            failures++;
+        }
+    }
+
+    printf("%lu phases of a %lu ms meter, %d failures\n", period / 500, period, failures);
+    return failures != 0;
+}
@@ -0,0 +1,35 @@
+// Logs messages longer than the Serial TX buffer has room for. They have to come out whole
+// and in order over several logDrain() passes, and the ring has to keep draining after them.
+#include "sketch.cpp"
+
+int main()
+{
+    setupLogger();
+    Serial.txRoom = 48;
+
+    // Only %d: a %s argument is kept as 32 bits, which does not hold a host pointer
+    #define LONG_MESSAGE "Message %d, longer than the room in the Serial TX buffer, so it takes a few passes to write out: %d"
+    std::string expected;
+    char line[LOG_LINE_LENGTH];
+    for (int i = 0; i < 20; i++)
+    {
+        mockMillis = 1000 + i;
+        LOG_INFO(LONG_MESSAGE, i, i * 1000);
+        int len = sprintf(line, "%lu I " LONG_MESSAGE "\r\n", mockMillis, i, i * 1000);
+        expected += std::string(line, len);
+    }
+
+    int passes = 0;
+    while (logTail != logHead && passes < 1000)
+    {
+        logDrain();
+        passes++;
+    }
+
+    bool ok = Serial.written == expected && logTail == logHead;
+    printf("%zu of %zu bytes written in %d passes of %d bytes, %s\n", Serial.written.size(), expected.size(), passes,
+           Serial.txRoom, ok ? "in order" : "different");
+    if (!ok)
+        printf("%s\n", Serial.written.c_str());
+    return !ok;
+}
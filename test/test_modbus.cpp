@@ -0,0 +1,76 @@
+// Sends two Modbus TCP requests split in two TCP segments at every byte offset, and one byte
+// at a time. The answers have to be the same as for requests that arrive in one piece.
+// A request shorter than a read has to get an exception.
+#include "sketch.cpp"
+
+int main()
+{
+    setupReadoutTable();
+    int power = findReadout("actual_consumption");
+    telegramObjects[power].value = 1234;
+    snapshotPublish();
+    setupModbus();
+
+    // Read input registers 0x34 (total power, float) and holding registers of actual_consumption
+    const uint8_t requests[] = {0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0x01, 0x04, 0x00, 0x34, 0x00, 0x02,
+                                0x00, 0x02, 0x00, 0x00, 0x00, 0x06, 0x01, 0x03, 0x00, (uint8_t)(2 * power), 0x00, 0x02};
+    const std::string stream((const char *)requests, sizeof(requests));
+    const uint8_t expected[] = {0x00, 0x01, 0x00, 0x00, 0x00, 0x07, 0x01, 0x04, 0x04, 0x44, 0x9A, 0x40, 0x00,
+                                0x00, 0x02, 0x00, 0x00, 0x00, 0x07, 0x01, 0x03, 0x04, 0x00, 0x00, 0x04, 0xD2};
+    const std::string answers((const char *)expected, sizeof(expected));
+    int failures = 0;
+
+    for (size_t split = 0; split <= stream.size(); split++)
+    {
+        WiFiClient client;
+        client.open = true;
+        struct ModbusFrame frame = {};
+        client.input = stream.substr(0, split);
+        modbusHandleClient(client, frame);
+        client.input = stream;
+        modbusHandleClient(client, frame);
+        if (client.output != answers || !client.open)
+        {
+            printf("split at %zu: %zu bytes answered\n", split, client.output.size());
+            failures++;
+        }
+    }
+
+    WiFiClient client;
+    client.open = true;
+    struct ModbusFrame frame = {};
+    for (size_t length = 1; length <= stream.size(); length++)
+    {
+        client.input = stream.substr(0, length);
+        modbusHandleClient(client, frame);
+    }
+    if (client.output != answers)
+    {
+        printf("byte by byte: %zu bytes answered\n", client.output.size());
+        failures++;
+    }
+
+    // A request too short for a start and quantity is refused, not answered from the previous one
+    client.output.clear();
+    client.input = std::string("\x00\x04\x00\x00\x00\x03\x01\x04\x00", 9);
+    client.inputPosition = 0;
+    modbusHandleClient(client, frame);
+    if (client.output != std::string("\x00\x04\x00\x00\x00\x03\x01\x84\x03", 9))
+    {
+        printf("short request: %zu bytes answered\n", client.output.size());
+        failures++;
+    }
+
+    // Another protocol than Modbus closes the connection
+    client.input = std::string("\x00\x03\x00\x01\x00\x06\x01\x04\x00\x00\x00\x02", 12);
+    client.inputPosition = 0;
+    modbusHandleClient(client, frame);
+    if (client.open)
+    {
+        printf("protocol id 1 was answered\n");
+        failures++;
+    }
+
+    printf("%zu split points, %d failures\n", stream.size() + 1, failures);
+    return failures != 0;
+}
@@ -0,0 +1,44 @@
+// Replays telegrams with a full readout table of the longest names and values, which do not
+// fit in the MQTT buffer. Every replayed message has to be a complete JSON object.
+#include "sketch.cpp"
+
+int main()
+{
+    setupReadoutTable();
+    numberOfReadouts = NUMBER_OF_READOUTS;
+    for (int i = 0; i < NUMBER_OF_READOUTS; i++)
+    {
+        char name[READOUT_NAME_SIZE];
+        snprintf(name, sizeof(name), "%02d_%s", i, "a_readout_with_a_long_name_xxxxxxxxxx");
+        telegramObjects[i].name = name;
+        telegramObjects[i].value = -2147483647 - 1;
+    }
+
+    std::vector<std::string> messages;
+    mockOnPublish = [&](const char *topic, const uint8_t *payload, unsigned int length) {
+        if (strcmp(topic, MQTT_BACKLOG_TOPIC) == 0)
+            messages.push_back(std::string((const char *)payload, length));
+    };
+
+    const int telegrams = 3;
+    for (int t = 0; t < telegrams; t++)
+    {
+        telegramSequence = t + 1;
+        outboxPush();
+    }
+    for (int t = 0; t < 10 * telegrams && !outboxIsEmpty(); t++)
+    {
+        mockMillis += OUTBOX_REPLAY_INTERVAL + OUTBOX_REPLAY_HOLDOFF;
+        outboxReplay();
+    }
+
+    int failures = messages.size() != telegrams || !outboxIsEmpty();
+    for (const std::string &message : messages)
+    {
+        int fields = std::count(message.begin(), message.end(), ':');
+        failures += message.front() != '{' || message.back() != '}' || fields != NUMBER_OF_READOUTS + 2;
+    }
+    printf("%zu of %d telegrams replayed, %zu bytes each, %d failures\n", messages.size(), telegrams,
+           messages.empty() ? 0 : messages[0].size(), failures);
+    return failures != 0;
+}
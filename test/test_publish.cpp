@@ -0,0 +1,52 @@
+// Counts coalesced publishes around the UPDATE_FULL_INTERVAL refresh. A value that replaces
+// one only flagged by the refresh loses nothing, one that replaces a new value does.
+#include "sketch.cpp"
+
+int main()
+{
+    setupReadoutTable();
+    setupP1Ports();
+    int failures = 0;
+    struct TelegramDecodedObject &object = p1Ports[0].objects[0];
+    object.interval = 0;
+
+    // Everything flagged by the refresh, then the first new value
+    object.sendData = true;
+    readoutPut(object, 100);
+    if (coalescedPublishes != 0)
+    {
+        printf("a value after the refresh counted as coalesced\n");
+        failures++;
+    }
+
+    // A second value before the first one was published
+    readoutPut(object, 200);
+    if (coalescedPublishes != 1)
+    {
+        printf("a replaced value counted %lu times, expected once\n", coalescedPublishes);
+        failures++;
+    }
+
+    std::string published;
+    mockOnPublish = [&](const char *topic, const uint8_t *payload, unsigned int length) {
+        if (strstr(topic, object.name.c_str()))
+            published.assign((const char *)payload, length);
+    };
+    sendDataToBroker(p1Ports[0]);
+    if (published != "200")
+    {
+        printf("published \"%s\", expected the latest value 200\n", published.c_str());
+        failures++;
+    }
+
+    // Published, the next value replaces nothing
+    readoutPut(object, 300);
+    if (coalescedPublishes != 1)
+    {
+        printf("a value after a publish counted as coalesced\n");
+        failures++;
+    }
+
+    printf("%lu coalesced of 3 values, %d failures\n", coalescedPublishes, failures);
+    return failures != 0;
+}
@@ -0,0 +1,152 @@
+// Pages through a history that is longer than one response, the way a client follows the
+// next= lines: every sample has to arrive exactly once, in order, in pages of bounded size.
+// Then queries all readouts, raw and per minute, whose header and rows are longer than a
+// chunk. Built with AddressSanitizer, see the Makefile.
+#include "sketch.cpp"
+#include <vector>
+
+std::string response;
+std::vector<std::string> messages;
+bool ended;
+
+/**
+ *  Runs a query over all readouts and checks the header, that every row has a value per
+ *  column and that every message holds complete rows.
+ */
+int checkAllFields(const char *request, bool tier, int expectedRows)
+{
+    response.clear();
+    messages.clear();
+    ended = false;
+    handleHistoryRequest((const uint8_t *)request, strlen(request));
+
+    std::string header = tier ? "timestamp,count" : "timestamp";
+    for (int i = 0; i < numberOfReadouts; i++)
+    {
+        std::string name = telegramObjects[i].name.c_str();
+        if (!tier)
+            header += "," + name;
+        else if (telegramObjects[i].counter)
+            header += "," + name + "_first," + name + "_last," + name + "_delta";
+        else
+            header += "," + name + "_min," + name + "_max," + name + "_mean";
+    }
+    int columns = tier ? 2 + 3 * numberOfReadouts : 1 + numberOfReadouts;
+
+    int failures = !ended || response.compare(0, header.size() + 1, header + "\n") != 0;
+    for (const std::string &message : messages)
+        failures += !message.empty() && message.back() != '\n';
+
+    int rows = 0;
+    size_t line = header.size() + 1;
+    while (line < response.size() && response.compare(line, 5, "next=") != 0)
+    {
+        size_t end = response.find('\n', line);
+        failures += std::count(response.begin() + line, response.begin() + end, ',') != columns - 1;
+        rows++;
+        line = end + 1;
+    }
+    failures += rows != expectedRows;
+
+    printf("%s: %zu byte header, %d rows of %d columns in %zu messages, %d failures\n", request, header.size(), rows,
+           columns, messages.size() - 1, failures);
+    return failures;
+}
+
+int runPage(unsigned long from, bool binary, unsigned long &next)
+{
+    char request[64];
+    sprintf(request, "from=%lu&fields=actual_consumption%s", from, binary ? "&format=bin" : "");
+    response.clear();
+    ended = false;
+    handleHistoryRequest((const uint8_t *)request, strlen(request));
+    if (!ended)
+        return -1;
+
+    next = 0;
+    int rows = 0;
+    if (binary)
+    {
+        for (size_t offset = 0; offset + 8 <= response.size(); offset += 8, rows++)
+        {
+            uint32_t timestamp, value;
+            memcpy(&timestamp, response.data() + offset, 4);
+            memcpy(&value, response.data() + offset + 4, 4);
+            if (timestamp == 0)
+                next = value;
+            else if (value != timestamp - 1000)
+                return -1;
+        }
+        return next ? rows - 1 : rows;
+    }
+
+    size_t line = response.find('\n') + 1; // the header
+    while (line < response.size())
+    {
+        unsigned long timestamp;
+        long value;
+        if (sscanf(response.c_str() + line, "next=%lu", &next) == 1)
+            break;
+        if (sscanf(response.c_str() + line, "%lu,%ld", &timestamp, &value) != 2 || value != (long)(timestamp - 1000))
+            return -1;
+        rows++;
+        line = response.find('\n', line) + 1;
+    }
+    return rows;
+}
+
+int main()
+{
+    setupReadoutTable();
+    setupHistory();
+    setupRollups();
+    mockOnPublish = [](const char *topic, const uint8_t *payload, unsigned int length) {
+        if (strcmp(topic, MQTT_HISTORY_RESPONSE_TOPIC) != 0)
+            return;
+        if (length == 0)
+            ended = true;
+        response.append((const char *)payload, length);
+        messages.push_back(std::string((const char *)payload, length));
+    };
+
+    const int samples = 3 * QUERY_MAX_ROWS + 17;
+    long values[NUMBER_OF_READOUTS] = {};
+    int power = findReadout("actual_consumption");
+    for (int i = 0; i < samples; i++)
+    {
+        values[power] = i;
+        historyAppend(1000 + i, values);
+        rollupUpdate(1000 + i, values);
+    }
+
+    int failures = 0;
+    for (int binary = 0; binary < 2; binary++)
+    {
+        unsigned long from = 0, next;
+        int total = 0, pages = 0;
+        while (true)
+        {
+            int rows = runPage(from, binary, next);
+            pages++;
+            if (rows < 0 || rows > QUERY_MAX_ROWS || (next != 0 && next != 1000 + (unsigned long)total + rows))
+            {
+                printf("%s page %d from %lu: %d rows, next %lu\n", binary ? "bin" : "csv", pages, from, rows, next);
+                failures++;
+                break;
+            }
+            total += rows;
+            if (next == 0)
+                break;
+            from = next;
+        }
+
+        printf("%s: %d samples in %d pages\n", binary ? "bin" : "csv", total, pages);
+        if (total != samples || pages != 4)
+            failures++;
+    }
+
+    failures += checkAllFields("from=0", false, QUERY_MAX_ROWS);
+    // The minute that is still open is not in the tier yet
+    failures += checkAllFields("from=0&tier=1m", true, (1000 + samples - 1) / 60 - 1000 / 60);
+    return failures != 0;
+}
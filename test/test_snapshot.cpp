@@ -0,0 +1,59 @@
+// One thread publishes telegrams as fast as it can while readers on other threads copy
+// the snapshot. In every telegram all values equal its sequence number, so a copy that
+// mixes two telegrams shows up as values that differ.
+#include "sketch.cpp"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+std::atomic<bool> stop(false);
+
+int main()
+{
+    setupReadoutTable();
+    const int readers = 3;
+    std::atomic<long> reads(0), torn(0), stale(0);
+
+    std::thread writer([]() {
+        for (unsigned long n = 1; !stop; n++)
+        {
+            for (int i = 0; i < numberOfReadouts; i++)
+                telegramObjects[i].value = n;
+            telegramSequence = n;
+            meterTimestamp = n;
+            snapshotPublish();
+        }
+    });
+
+    std::vector<std::thread> threads;
+    for (int r = 0; r < readers; r++)
+    {
+        threads.emplace_back([&]() {
+            unsigned long last = 0;
+            while (!stop)
+            {
+                struct TelegramSnapshot snapshot;
+                snapshotRead(snapshot);
+                bool same = snapshot.timestamp == snapshot.sequence;
+                for (int i = 0; i < NUMBER_OF_READOUTS; i++)
+                    same = same && snapshot.values[i] == (i < numberOfReadouts ? (long)snapshot.sequence : 0);
+                if (!same)
+                    torn++;
+                if (snapshot.sequence < last)
+                    stale++; // went back to an older telegram
+                last = snapshot.sequence;
+                reads++;
+            }
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+    stop = true;
+    writer.join();
+    for (std::thread &thread : threads)
+        thread.join();
+
+    printf("%d readers, %ld reads of %lu telegrams, %ld torn, %ld out of order\n", readers, reads.load(),
+           (unsigned long)telegramSequence, torn.load(), stale.load());
+    return torn != 0 || stale != 0 || reads == 0;
+}
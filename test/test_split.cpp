@@ -0,0 +1,58 @@
+// Feeds a telegram, preceded by garbage and followed by a second one, in two parts split
+// at every byte offset. Both telegrams have to be committed with the same values, however
+// the reads happen to cut through them.
+#include "sketch.cpp"
+#include "telegrams.h"
+
+void resetPort(struct P1Port &port)
+{
+    port.detecting = false; // the mock NVS is empty, so setupP1Ports() started a detection
+    port.rxPosition = 0;
+    port.rxLength = 0;
+    port.inTelegram = false;
+    port.lineLength = 0;
+    port.telegramLines = 0;
+    port.currentCRC = 0;
+    port.crcFailures = 0;
+    port.lastValidMillis = millis();
+    for (int i = 0; i < numberOfReadouts; i++)
+        port.objects[i].value = -1;
+}
+
+int main()
+{
+    setupReadoutTable();
+    setupDerivedMetrics();
+    setupGridLimits();
+    setupP1Ports();
+
+    std::string stream = std::string("garbage\r\n") + testTelegram + testTelegram;
+    struct P1Port &port = p1Ports[0];
+    int consumption = findReadout("consumption_tarif_1");
+    int power = findReadout("actual_consumption");
+    int failures = 0;
+
+    for (size_t split = 1; split < stream.size(); split++)
+    {
+        resetPort(port);
+        port.serial->feedBytes(stream.data(), split);
+        int commits = 0;
+        while (readP1Serial(port))
+            commits++;
+
+        port.serial->feedLength = stream.size();
+        while (readP1Serial(port))
+            commits++;
+
+        if (commits != 2 || port.objects[consumption].value != 1869223 || port.objects[power].value != 52 ||
+            meterTimestamp != 1618043419)
+        {
+            printf("split at %zu: %d telegrams, consumption %ld, power %ld, timestamp %lu\n", split, commits,
+                   port.objects[consumption].value, port.objects[power].value, meterTimestamp);
+            failures++;
+        }
+    }
+
+    printf("%zu split points, %d failures\n", stream.size() - 1, failures);
+    return failures != 0;
+}
@@ -1,13 +1,73 @@
-void blinkLed(int numberOfBlinks, int msBetweenBlinks)
+/**
+ *  Converts a DSMR timestamp (YYMMDDhhmmssX) to UTC seconds since epoch.
+ *  X is S for summer time (CEST, UTC+2) and W for winter time (CET, UTC+1),
+ *  all DSMR meters (NL, BE, LU) run on central european time.
+ */
+unsigned long meterTimeToEpoch(const char *timestamp)
 {
-  for (int i = 0; i < numberOfBlinks; i++)
+  int field[6];
+  for (int i = 0; i < 6; i++)
   {
-    digitalWrite(LED_BUILTIN, HIGH);
-    delay(msBetweenBlinks);
-    digitalWrite(LED_BUILTIN, LOW);
-    if (i != numberOfBlinks - 1)
+    if (!isdigit(timestamp[2 * i]) || !isdigit(timestamp[2 * i + 1]))
     {
-      delay(msBetweenBlinks);
+      return 0;
     }
+    field[i] = (timestamp[2 * i] - '0') * 10 + (timestamp[2 * i + 1] - '0');
   }
+
+  // Days since 1970-01-01 for a civil date, see http://howardhinnant.github.io/date_algorithms.html
+  int year = 2000 + field[0];
+  int month = field[1];
+  int day = field[2];
+  year -= month <= 2;
+  long era = year / 400;
+  long yearOfEra = year - era * 400;
+  long dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  long dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  long days = era * 146097 + dayOfEra - 719468;
+
+  unsigned long localTime = days * 86400UL + field[3] * 3600UL + field[4] * 60UL + field[5];
+  return localTime - (timestamp[12] == 'S' ? 7200 : 3600);
+}
+
+/**
+ *  Returns the index in telegramObjects of the readout with this name, or -1.
+ */
+int findReadout(const char *name)
+{
+  for (int i = 0; i < numberOfReadouts; i++)
+  {
+    if (telegramObjects[i].name == name)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ *  Writes a value in thousandths as a decimal number, e.g. 1869223 as 1869.223
+ */
+int printMilli(char *buffer, int size, long value)
+{
+  const char *sign = value < 0 ? "-" : "";
+  unsigned long absolute = value < 0 ? -value : value;
+  return snprintf(buffer, size, "%s%lu.%03lu", sign, absolute / 1000, absolute % 1000);
+}
+
+/**
+ *  Returns year * 12 + month - 1 in central european (winter) time for a UTC timestamp.
+ */
+long epochMonth(unsigned long timestamp)
+{
+  // Civil date from days since 1970-01-01, see http://howardhinnant.github.io/date_algorithms.html
+  long days = (timestamp + 3600) / 86400 + 719468;
+  long era = days / 146097;
+  long dayOfEra = days - era * 146097;
+  long yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+  long dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+  long mp = (5 * dayOfYear + 2) / 153;
+  long month = mp < 10 ? mp + 3 : mp - 9;
+  long year = yearOfEra + era * 400 + (month <= 2);
+  return year * 12 + month - 1;
 }